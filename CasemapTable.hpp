@@ -0,0 +1,158 @@
+#ifndef CASEMAP_TABLE_HPP
+#define CASEMAP_TABLE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// RFC 1459 casemapping: A-Z and []\^ fold to a-z and {}|~.
+inline char ircToLower(char c) {
+    if (c >= 'A' && c <= '^') {
+        return c + ('a' - 'A');
+    }
+    return c;
+}
+
+inline std::string ircCasefold(const std::string& text) {
+    std::string folded(text);
+    for (size_t i = 0; i < folded.length(); ++i) {
+        folded[i] = ircToLower(folded[i]);
+    }
+    return folded;
+}
+
+// Chained hash table keyed by IRC names under RFC 1459 casemapping. Keys
+// are stored folded; lookups fold on the fly, so finding a name never
+// allocates.
+template <typename T>
+class CasemapTable {
+private:
+    struct Node {
+        std::string key;
+        T value;
+        Node* next;
+    };
+
+    std::vector<Node*> buckets;
+    size_t count;
+
+    CasemapTable(const CasemapTable& other);
+    CasemapTable& operator=(const CasemapTable& other);
+
+    static size_t hash(const char* name, size_t length) {
+        size_t h = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            h = (h ^ static_cast<unsigned char>(ircToLower(name[i]))) * 16777619u;
+        }
+        return h;
+    }
+
+    static bool matches(const std::string& key, const char* name, size_t length) {
+        if (key.length() != length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (key[i] != ircToLower(name[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Node** slot(const char* name, size_t length) {
+        Node** link = &buckets[hash(name, length) & (buckets.size() - 1)];
+        while (*link && !matches((*link)->key, name, length)) {
+            link = &(*link)->next;
+        }
+        return link;
+    }
+
+    void grow() {
+        std::vector<Node*> old;
+        old.swap(buckets);
+        buckets.assign(old.size() * 2, NULL);
+        for (size_t i = 0; i < old.size(); ++i) {
+            Node* node = old[i];
+            while (node) {
+                Node* next = node->next;
+                Node*& head = buckets[hash(node->key.data(), node->key.length()) & (buckets.size() - 1)];
+                node->next = head;
+                head = node;
+                node = next;
+            }
+        }
+    }
+
+public:
+    CasemapTable() : buckets(64, static_cast<Node*>(NULL)), count(0) {
+    }
+
+    ~CasemapTable() {
+        clear();
+    }
+
+    T* find(const char* name, size_t length) {
+        Node* node = *slot(name, length);
+        return node ? &node->value : NULL;
+    }
+
+    T* find(const std::string& name) {
+        return find(name.data(), name.length());
+    }
+
+    // Returns false and leaves the table unchanged if the name is taken.
+    bool insert(const std::string& name, const T& value) {
+        Node** link = slot(name.data(), name.length());
+        if (*link) {
+            return false;
+        }
+        Node* node = new Node;
+        node->key = ircCasefold(name);
+        node->value = value;
+        node->next = NULL;
+        *link = node;
+        if (++count > buckets.size()) {
+            grow();
+        }
+        return true;
+    }
+
+    bool erase(const std::string& name) {
+        Node** link = slot(name.data(), name.length());
+        Node* node = *link;
+        if (!node) {
+            return false;
+        }
+        *link = node->next;
+        delete node;
+        count--;
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            Node* node = buckets[i];
+            while (node) {
+                Node* next = node->next;
+                delete node;
+                node = next;
+            }
+            buckets[i] = NULL;
+        }
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    void values(std::vector<T>& out) const {
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            for (Node* node = buckets[i]; node; node = node->next) {
+                out.push_back(node->value);
+            }
+        }
+    }
+};
+
+#endif
@@ -4,6 +4,8 @@
 
 Channel::Channel(const std::string& name) :
     name(name),
+    memberCount(0),
+    operatorCount(0),
     userLimit(0),
     inviteOnly(false),
     topicRestricted(false) {
@@ -13,8 +15,8 @@ std::string Channel::getName() const {
     return name;
 }
 
-const std::set<int>& Channel::getUsers() const {
-    return users;
+const std::vector<Channel::Member>& Channel::getMembers() const {
+    return members;
 }
 
 std::string Channel::getTopic() const {
@@ -48,74 +50,174 @@ void Channel::setUserLimit(int limit) {
     userLimit = limit;
 }
 
-void Channel::addUser(int fd) {
-    users.insert(fd);
-    if (users.size() == 1)
-        addOperator(fd);
+Channel::Member* Channel::findMember(int fd) {
+    size_t position;
+    return positions.find(fd, position) ? &members[position] : NULL;
+}
+
+const Channel::Member* Channel::findMember(int fd) const {
+    size_t position;
+    return positions.find(fd, position) ? &members[position] : NULL;
+}
+
+Channel::Member& Channel::record(int fd) {
+    Member* member = findMember(fd);
+    if (member) {
+        return *member;
+    }
+
+    Member fresh;
+    fresh.user = NULL;
+    fresh.fd = fd;
+    fresh.flags = 0;
+    positions.set(fd, members.size());
+    members.push_back(fresh);
+    return members.back();
+}
+
+void Channel::setFlag(int fd, unsigned int flag, bool value) {
+    Member* member = value ? &record(fd) : findMember(fd);
+    if (!member || ((member->flags & flag) != 0) == value) {
+        return;
+    }
+
+    if (flag == OPERATOR) {
+        value ? operatorCount++ : operatorCount--;
+    }
+    if (value) {
+        member->flags |= flag;
+        return;
+    }
+    member->flags &= ~flag;
+    if (member->flags == 0) {
+        removeUser(fd);
+    }
+}
+
+void Channel::addUser(User* user) {
+    Member& member = record(user->getFd());
+    if (member.flags & MEMBER) {
+        return;
+    }
+    member.user = user;
+    member.flags |= MEMBER;
+    if (++memberCount == 1)
+        addOperator(user->getFd());
 }
 
 void Channel::removeUser(int fd) {
-    users.erase(fd);
-    operators.erase(fd);
-    invited.erase(fd);
+    size_t position;
+    if (!positions.find(fd, position)) {
+        return;
+    }
+
+    if (members[position].flags & MEMBER) memberCount--;
+    if (members[position].flags & OPERATOR) operatorCount--;
+
+    positions.erase(fd);
+    if (position != members.size() - 1) {
+        members[position] = members.back();
+        positions.set(members[position].fd, position);
+    }
+    members.pop_back();
 }
 
 bool Channel::hasUser(int fd) const {
-    return users.find(fd) != users.end();
+    const Member* member = findMember(fd);
+    return member && (member->flags & MEMBER);
 }
 
 void Channel::addOperator(int fd) {
-    operators.insert(fd);
+    setFlag(fd, OPERATOR, true);
 }
 
 void Channel::removeOperator(int fd) {
-    operators.erase(fd);
+    setFlag(fd, OPERATOR, false);
 }
 
 bool Channel::isOperator(int fd) const {
-    return operators.find(fd) != operators.end();
+    const Member* member = findMember(fd);
+    return member && (member->flags & OPERATOR);
 }
 
 bool Channel::isLastOperator(int fd) const {
-    return operators.size() == 1 && isOperator(fd);
+    return operatorCount == 1 && isOperator(fd);
 }
 
 void Channel::addInvited(int fd) {
-    invited.insert(fd);
+    setFlag(fd, INVITED, true);
 }
 
 bool Channel::isInvited(int fd) const {
-    return invited.find(fd) != invited.end();
+    const Member* member = findMember(fd);
+    return member && (member->flags & INVITED);
 }
 
 void Channel::removeInvited(int fd) {
-    invited.erase(fd);
+    setFlag(fd, INVITED, false);
 }
 
 void Channel::broadcast(int sender_fd, const std::string& message, Server* server) {
-    std::set<int>::iterator it;
-    for (it = users.begin(); it != users.end(); ++it) {
-        if (*it != sender_fd) {
-            if (*it > 0) {
-                if (server) {
-
-                    User* user = server->getUser(*it);
-                    if (user) {
-                        user->sendMessage(message);
-                    }
-                } else {
-
-                    int result = send(*it, (message + "\r\n").c_str(), message.length() + 2, MSG_NOSIGNAL);
-                    if (result < 0)
-                        std::cerr << "Error sending message to fd " << *it << ": " << strerror(errno) << std::endl;
-                }
+    broadcast(sender_fd, SharedBuffer::fromLine(message), server);
+}
+
+void Channel::broadcast(int sender_fd, const SharedBuffer& line, Server* server, OutputQueue::Priority priority) {
+    size_t recipients = 0;
+    for (size_t i = 0; i < members.size(); ++i) {
+        const Member& member = members[i];
+        if (!(member.flags & MEMBER) || member.fd == sender_fd || member.fd <= 0) {
+            continue;
+        }
+        recipients++;
+
+        if (server) {
+            member.user->sendMessage(line, priority);
+        } else {
+            int result = send(member.fd, line.data(), line.length(), MSG_NOSIGNAL);
+            if (result < 0)
+                Log(Logger::WARN, "channel send error").field("fd", member.fd).field("error", strerror(errno));
+        }
+    }
+
+    Reactor* current = Reactor::current();
+    if (current) {
+        current->getFanout().record(recipients);
+    }
+}
+
+// Sends one copy to every distinct user sharing a channel with user.
+// Users are stamped with a fresh epoch as they are reached, so overlap
+// between channels costs a compare instead of a duplicate line.
+void Channel::broadcastToNeighbors(User* user, const SharedBuffer& line, bool includeSelf) {
+    static unsigned long long epoch = 0;
+    ++epoch;
+
+    size_t recipients = 0;
+    user->stampFanout(epoch);
+    if (includeSelf) {
+        user->sendMessage(line);
+        recipients++;
+    }
+
+    const std::vector<Channel*>& joined = user->getCurrentChannels();
+    for (size_t c = 0; c < joined.size(); ++c) {
+        const std::vector<Member>& peers = joined[c]->members;
+        for (size_t i = 0; i < peers.size(); ++i) {
+            if ((peers[i].flags & MEMBER) && peers[i].user->stampFanout(epoch)) {
+                peers[i].user->sendMessage(line);
+                recipients++;
             }
         }
     }
+
+    Reactor* current = Reactor::current();
+    if (current) {
+        current->getFanout().record(recipients);
+    }
 }
 
 unsigned int Channel::getUserCount() const {
-    return users.size();
+    return memberCount;
 }
 
 void Channel::setInviteOnly(bool value) {
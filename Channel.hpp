@@ -8,23 +8,50 @@
 #include <sstream>
 #include <cerrno>
 #include <iostream>
+#include <vector>
+#include "FdIndex.hpp"
+#include "OutputQueue.hpp"
+
+class User;
 
 class Channel {
+public:
+    enum MemberFlag {
+        MEMBER = 1,
+        OPERATOR = 2,
+        VOICE = 4,
+        INVITED = 8
+    };
 
+    // One record per connection the channel knows about. Invited users get
+    // a record before they join; user is only set while MEMBER is.
+    struct Member {
+        User* user;
+        int fd;
+        unsigned int flags;
+    };
+
+private:
     std::string name;
     std::string topic;
-    std::set<int> users;
-    std::set<int> operators;
-    std::set<int> invited;
+    std::vector<Member> members;
+    FdIndex positions;
+    unsigned int memberCount;
+    unsigned int operatorCount;
     std::string password;
     int userLimit;
     bool inviteOnly;
     bool topicRestricted;
 
+    Member* findMember(int fd);
+    const Member* findMember(int fd) const;
+    Member& record(int fd);
+    void setFlag(int fd, unsigned int flag, bool value);
+
 public:
     Channel(const std::string& name);
 
-    void addUser(int fd);
+    void addUser(User* user);
     void removeUser(int fd);
     bool hasUser(int fd) const;
     void addOperator(int fd);
@@ -48,10 +75,13 @@ public:
     std::string getName() const;
     void setTopic(const std::string& newTopic);
     std::string getTopic() const;
-    const std::set<int>& getUsers() const;
+    const std::vector<Member>& getMembers() const;
     unsigned int getUserCount() const;
 
     void broadcast(int sender_fd, const std::string& message, class Server* server = NULL);
+    void broadcast(int sender_fd, const SharedBuffer& line, class Server* server = NULL,
+                   OutputQueue::Priority priority = OutputQueue::NORMAL);
+    static void broadcastToNeighbors(User* user, const SharedBuffer& line, bool includeSelf);
 };
 
 #endif
@@ -1,88 +1,192 @@
 #include "CommandHandler.hpp"
 
-CommandHandler::CommandHandler(Server& server) : server(server) {}
+CommandHandler::CommandHandler(Server& server) : server(server) {
+    // Commands that only read nicks, channels and other users run under
+    // the shared side of the state lock; the rest change them.
+    define(CMD_PASS, "PASS", &CommandHandler::handlePass, 1, ANYONE, 1, Server::StateGuard::EXCLUSIVE);
+    define(CMD_NICK, "NICK", &CommandHandler::handleNick, 0, AUTHENTICATED, 2, Server::StateGuard::EXCLUSIVE);
+    define(CMD_USER, "USER", &CommandHandler::handleUser, 4, AUTHENTICATED, 1, Server::StateGuard::EXCLUSIVE);
+    define(CMD_JOIN, "JOIN", &CommandHandler::handleJoin, 1, REGISTERED, 2, Server::StateGuard::EXCLUSIVE);
+    define(CMD_PART, "PART", &CommandHandler::handlePart, 1, REGISTERED, 1, Server::StateGuard::EXCLUSIVE);
+    define(CMD_PRIVMSG, "PRIVMSG", &CommandHandler::handlePrivmsg, 0, REGISTERED, 1, Server::StateGuard::SHARED);
+    define(CMD_QUIT, "QUIT", &CommandHandler::handleQuit, 0, REGISTERED, 1, Server::StateGuard::EXCLUSIVE);
+    define(CMD_KICK, "KICK", &CommandHandler::handleKick, 2, REGISTERED, 2, Server::StateGuard::EXCLUSIVE);
+    define(CMD_MODE, "MODE", &CommandHandler::handleMode, 1, REGISTERED, 1, Server::StateGuard::EXCLUSIVE);
+    define(CMD_TOPIC, "TOPIC", &CommandHandler::handleTopic, 1, REGISTERED, 2, Server::StateGuard::EXCLUSIVE);
+    define(CMD_INVITE, "INVITE", &CommandHandler::handleInvite, 2, REGISTERED, 2, Server::StateGuard::EXCLUSIVE);
+    define(CMD_PING, "PING", &CommandHandler::handlePing, 0, REGISTERED, 1, Server::StateGuard::SHARED);
+    define(CMD_PONG, "PONG", &CommandHandler::handlePong, 0, REGISTERED, 0, Server::StateGuard::SHARED);
+    define(CMD_OPER, "OPER", &CommandHandler::handleOper, 2, REGISTERED, 4, Server::StateGuard::EXCLUSIVE);
+    define(CMD_STATS, "STATS", &CommandHandler::handleStats, 0, REGISTERED, 2, Server::StateGuard::SHARED);
+    define(CMD_UNKNOWN, "UNKNOWN", NULL, 0, REGISTERED, 1, Server::StateGuard::SHARED);
+}
+
+void CommandHandler::define(CommandId id, const char* name, Handler handler, size_t minParams, Access access, int floodCost,
+                            Server::StateGuard::Mode locking) {
+    Command& entry = commands[id];
+    entry.name = name;
+    entry.handler = handler;
+    entry.minParams = minParams;
+    entry.access = access;
+    entry.floodCost = floodCost;
+    entry.locking = locking;
+    entry.calls = 0;
+    entry.cpuNs = 0;
+    entry.linesIn = 0;
+    entry.linesOut = 0;
+}
+
+// Switches on length and first letter, then confirms with one compare.
+CommandHandler::CommandId CommandHandler::lookup(const std::string& command) {
+    CommandId id = CMD_UNKNOWN;
+    switch (command.length()) {
+        case 4:
+            switch (command[0]) {
+                case 'J': id = CMD_JOIN; break;
+                case 'K': id = CMD_KICK; break;
+                case 'M': id = CMD_MODE; break;
+                case 'N': id = CMD_NICK; break;
+                case 'O': id = CMD_OPER; break;
+                case 'Q': id = CMD_QUIT; break;
+                case 'U': id = CMD_USER; break;
+                case 'P':
+                    switch (command[1]) {
+                        case 'A': id = (command[2] == 'S') ? CMD_PASS : CMD_PART; break;
+                        case 'I': id = CMD_PING; break;
+                        case 'O': id = CMD_PONG; break;
+                    }
+                    break;
+            }
+            break;
+        case 5:
+            if (command[0] == 'T') id = CMD_TOPIC;
+            if (command[0] == 'S') id = CMD_STATS;
+            break;
+        case 6:
+            if (command[0] == 'I') id = CMD_INVITE;
+            break;
+        case 7:
+            if (command[0] == 'P') id = CMD_PRIVMSG;
+            break;
+    }
 
-void CommandHandler::parseMessage(User* user, const std::string& message) {
-    std::vector<std::string> parts = splitMessage(message);
-    if (parts.empty()) return;
+    static const char* const names[CMD_COUNT] = {
+        "PASS", "NICK", "USER", "JOIN", "PART", "PRIVMSG", "QUIT",
+        "KICK", "MODE", "TOPIC", "INVITE", "PING", "PONG", "OPER", "STATS"
+    };
+    if (id != CMD_UNKNOWN && command != names[id]) {
+        id = CMD_UNKNOWN;
+    }
+    return id;
+}
 
-    std::string command = parts[0];
-    for (std::string::iterator it = command.begin(); it != command.end(); ++it) {
+static unsigned long long threadCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Returns the flood cost of the command the line carried.
+int CommandHandler::parseMessage(User* user, const char* line, size_t length) {
+    if (!IrcMessage::parse(line, length, message)) return 0;
+
+    token.assign(message.command.data, message.command.length);
+    for (std::string::iterator it = token.begin(); it != token.end(); ++it) {
         *it = toupper(*it);
     }
 
-    parts.erase(parts.begin());
-    executeCommand(user, command, parts);
+    message.copyParams(arguments);
+    Command& entry = commands[lookup(token)];
+    execute(user, entry, token, arguments);
+    return entry.floodCost;
 }
 
 void CommandHandler::executeCommand(User* user, const std::string& command, const std::vector<std::string>& args) {
-    if (command != "PASS" && !isUserAuthenticated(user)) {
+    execute(user, commands[lookup(command)], command, args);
+}
+
+// Every line is counted against its command, accepted or not, together
+// with the lines it caused this reactor to send.
+void CommandHandler::execute(User* user, Command& entry, const std::string& command, const std::vector<std::string>& args) {
+    Server::StateGuard guard(server, entry.locking);
+    Reactor* reactor = Reactor::current();
+    unsigned long long sent = reactor ? reactor->getIoStats().lines_out : 0;
+    entry.linesIn++;
+    dispatch(user, entry, command, args);
+    if (reactor) {
+        entry.linesOut += reactor->getIoStats().lines_out - sent;
+    }
+}
+
+void CommandHandler::dispatch(User* user, Command& entry, const std::string& command, const std::vector<std::string>& args) {
+    if (entry.access != ANYONE && !isUserAuthenticated(user)) {
+        return;
+    }
+    if (entry.access == REGISTERED && !isUserRegistered(user)) {
         return;
     }
 
-    if (command != "PASS" && command != "NICK" && command != "USER" && !isUserRegistered(user)) {
+    if (args.size() < entry.minParams) {
+        const std::string& nick = user->getNickname();
+        user->sendMessage((LineBuilder() << ":server 461 " << (nick.empty() ? "*" : nick.c_str()) << ' ' << command << " :Not enough parameters").finish());
         return;
     }
 
-    if (command == "PASS") {
-        handlePass(user, args);
-    } else if (command == "NICK") {
-        handleNick(user, args);
-    } else if (command == "USER") {
-        handleUser(user, args);
-    } else if (command == "JOIN") {
-        handleJoin(user, args);
-    } else if (command == "PART") {
-        handlePart(user, args);
-    } else if (command == "PRIVMSG") {
-        handlePrivmsg(user, args);
-    } else if (command == "QUIT") {
-        handleQuit(user, args);
-    } else if (command == "KICK") {
-        handleKick(user, args);
-    } else if (command == "MODE") {
-        handleMode(user, args);
-    } else if (command == "TOPIC") {
-        handleTopic(user, args);
-    } else if (command == "INVITE") {
-        handleInvite(user, args);
-    } else if (command == "PING") {
-        if (!args.empty()) {
-            user->sendMessage(":localhost PONG :" + args[0]);
-        } else {
-            user->sendMessage(":localhost PONG :");
-        }
-    } else {
-        if (user->isAuthenticated() && user->isRegistered()) {
-            user->sendMessage(":server 421 " + user->getNickname() + " " + command + " :Unknown command");
-        }
+    if (!entry.handler) {
+        user->sendMessage((LineBuilder() << ":server 421 " << user->getNickname() << ' ' << command << " :Unknown command").finish());
+        entry.calls++;
+        return;
     }
+
+    // Wall time comes from the reactor's vDSO clock. Thread CPU time is a
+    // real syscall, so only one call in CPU_SAMPLE_INTERVAL pays for it
+    // and stands in for the others.
+    Reactor* reactor = Reactor::current();
+    bool sampled = (entry.calls % CPU_SAMPLE_INTERVAL == 0);
+    unsigned long long cpu_start = sampled ? threadCpuNs() : 0;
+    unsigned long long start = reactor ? reactor->stampNs() : LatencyHistogram::now();
+    (this->*entry.handler)(user, args);
+    unsigned long long end = reactor ? reactor->stampNs() : LatencyHistogram::now();
+    if (sampled) {
+        entry.cpuNs += (threadCpuNs() - cpu_start) * CPU_SAMPLE_INTERVAL;
+    }
+    entry.calls++;
+    entry.latency.record(end - start);
 }
 
-std::vector<std::string> CommandHandler::splitMessage(const std::string& message) {
-    std::vector<std::string> result;
-    std::istringstream iss(message);
-    std::string token;
-    bool found_colon = false;
-    while (!found_colon && iss >> token) {
-        if (token[0] == ':') {
-            found_colon = true;
-            std::string trailing = token;
-            std::string rest;
-            std::getline(iss, rest);
-            if (!rest.empty()) {
-                trailing += rest;
-            }
-            result.push_back(trailing);
-            break;
-        } else {
-            result.push_back(token);
+const CommandHandler::Command* CommandHandler::getCommands(size_t& count) const {
+    count = CMD_COUNT + 1;
+    return commands;
+}
+
+// Sums the counters of every reactor's handler into one table. The
+// counters are read while their reactors keep running, like the other
+// per-reactor statistics.
+void CommandHandler::totalCommands(const std::vector<CommandHandler*>& handlers, std::vector<Command>& totals) {
+    totals.assign(handlers[0]->commands, handlers[0]->commands + CMD_COUNT + 1);
+    for (size_t h = 1; h < handlers.size(); ++h) {
+        for (size_t i = 0; i <= CMD_COUNT; ++i) {
+            const Command& entry = handlers[h]->commands[i];
+            totals[i].calls += entry.calls;
+            totals[i].cpuNs += entry.cpuNs;
+            totals[i].linesIn += entry.linesIn;
+            totals[i].linesOut += entry.linesOut;
+            totals[i].latency.merge(entry.latency);
         }
     }
-    if (!found_colon && !token.empty() && token[0] == ':') {
-        result.push_back(token);
+}
+
+// 324 reply; the server fd stands in for the server name, as it always has.
+void CommandHandler::sendChannelModes(User* user, Channel& channel, const std::string& name) {
+    LineBuilder reply;
+    reply << ':' << server.getServerFd() << " 324 " << user->getNickname() << ' ' << name << ' ' << channel.getModeFlags();
+    if (!channel.getPassword().empty()) {
+        reply << ' ' << channel.getPassword();
     }
-    return result;
+    if (channel.getUserLimit() > 0) {
+        reply << ' ' << channel.getUserLimit();
+    }
+    user->sendMessage(reply.finish());
 }
 
 std::vector<std::string> CommandHandler::splitByComma(const std::string& str) {
@@ -131,7 +235,7 @@ bool CommandHandler::isValidChannelName(const std::string& channel) {
 
 bool CommandHandler::isUserAuthenticated(User* user) {
     if (!user->isAuthenticated()) {
-        user->sendMessage(":server 464 * :Password required");
+        user->sendMessage((LineBuilder() << ":server 464 * :Password required").finish());
         return false;
     }
     return true;
@@ -139,57 +243,43 @@ bool CommandHandler::isUserAuthenticated(User* user) {
 
 bool CommandHandler::isUserRegistered(User* user) {
     if (!user->isRegistered()) {
-        user->sendMessage(":server 451 * :You have not registered");
+        user->sendMessage((LineBuilder() << ":server 451 * :You have not registered").finish());
         return false;
     }
     return true;
 }
 
 void CommandHandler::handleNick(User* user, const std::vector<std::string>& args) {
-    if (!isUserAuthenticated(user)) {
-        return;
-    }
-
     if (args.empty()) {
-        user->sendMessage(":server 431 * :No nickname given");
+        user->sendMessage((LineBuilder() << ":server 431 * :No nickname given").finish());
         return;
     }
 
     std::string newNick = args[0];
     if (!isValidNickname(newNick)) {
-        user->sendMessage(":server 432 * " + newNick + " :Erroneous nickname");
+        user->sendMessage((LineBuilder() << ":server 432 * " << newNick << " :Erroneous nickname").finish());
         return;
     }
 
-    const std::map<int, User*>& users = server.getUsers();
-    std::map<int, User*>::const_iterator it;
-    for (it = users.begin(); it != users.end(); ++it) {
-        if (it->second->getNickname() == newNick) {
-            user->sendMessage(":server 433 * " + newNick + " :Nickname is already in use");
-            return;
-        }
+    // Built first: the neighbours know the user by the old prefix.
+    LineBuilder nick_msg;
+    nick_msg << ':' << user->getPrefix() << " NICK :" << newNick;
+    if (user->getNickname() == newNick || !server.setNickname(user, newNick)) {
+        user->sendMessage((LineBuilder() << ":server 433 * " << newNick << " :Nickname is already in use").finish());
+        return;
     }
 
-    user->setNickname(newNick);
-
-    if (!user->getUsername().empty() && !user->isRegistered()) {
+    if (user->isRegistered()) {
+        Channel::broadcastToNeighbors(user, nick_msg.finish(), true);
+    } else if (!user->getUsername().empty()) {
         user->setRegistered(true);
-        user->sendMessage(":server 001 " + user->getNickname() + " :Welcome to the IRC Network " + user->getNickname());
+        user->sendMessage((LineBuilder() << ":server 001 " << user->getNickname() << " :Welcome to the IRC Network " << user->getNickname()).finish());
     }
 }
 
 void CommandHandler::handleUser(User* user, const std::vector<std::string>& args) {
-    if (!isUserAuthenticated(user)) {
-        return;
-    }
-
-    if (args.size() < 4) {
-        user->sendMessage(":server 461 * USER :Not enough parameters");
-        return;
-    }
-
     if (user->isRegistered()) {
-        user->sendMessage(":server 462 * :You may not reregister");
+        user->sendMessage((LineBuilder() << ":server 462 * :You may not reregister").finish());
         return;
     }
 
@@ -198,16 +288,11 @@ void CommandHandler::handleUser(User* user, const std::vector<std::string>& args
 
     if (!user->getNickname().empty() && !user->isRegistered()) {
         user->setRegistered(true);
-        user->sendMessage(":server 001 " + user->getNickname() + " :Welcome to the IRC Network " + user->getNickname());
+        user->sendMessage((LineBuilder() << ":server 001 " << user->getNickname() << " :Welcome to the IRC Network " << user->getNickname()).finish());
     }
 }
 
 void CommandHandler::handleJoin(User* user, const std::vector<std::string>& args) {
-    if (args.empty()) {
-        user->sendMessage(":server 461 JOIN :Not enough parameters");
-        return;
-    }
-
     std::vector<std::string> channels = splitByComma(args[0]);
     std::vector<std::string> keys;
 
@@ -220,109 +305,91 @@ void CommandHandler::handleJoin(User* user, const std::vector<std::string>& args
         std::string key = (i < keys.size()) ? keys[i] : "";
 
         if (!isValidChannelName(channel_name)) {
-            user->sendMessage(":server 403 " + channel_name + " :No such channel");
+            user->sendMessage((LineBuilder() << ":server 403 " << channel_name << " :No such channel").finish());
             continue;
         }
 
-        Channel* channel = server.getChannel(channel_name);
-        if (!channel) {
-            server.createChannel(channel_name);
-            channel = server.getChannel(channel_name);
-        }
+        Channel* channel = server.createChannel(channel_name);
 
         if (channel->isInviteOnly() && !channel->isInvited(user->getFd())) {
-            user->sendMessage(":server 473 " + channel_name + " :Cannot join channel (+i)");
+            user->sendMessage((LineBuilder() << ":server 473 " << channel_name << " :Cannot join channel (+i)").finish());
             continue;
         }
 
         if (!channel->getPassword().empty()) {
             if (key.empty() || key != channel->getPassword()) {
-                user->sendMessage(":server 475 " + channel_name + " :Cannot join channel (+k)");
+                user->sendMessage((LineBuilder() << ":server 475 " << channel_name << " :Cannot join channel (+k)").finish());
                 continue;
             }
         }
 
         if (channel->getUserLimit() > 0 && channel->getUserCount() >= (size_t)channel->getUserLimit()) {
-            user->sendMessage(":server 471 " + channel_name + " :Cannot join channel (+l)");
+            user->sendMessage((LineBuilder() << ":server 471 " << channel_name << " :Cannot join channel (+l)").finish());
             continue;
         }
 
-        channel->addUser(user->getFd());
-        user->joinChannel(channel_name);
+        channel->addUser(user);
+        user->joinChannel(channel);
 
         if (channel->isInvited(user->getFd())) {
             channel->removeInvited(user->getFd());
         }
 
-        std::string join_msg = ":" + user->getNickname() + "!" + user->getUsername() + "@localhost JOIN :" + channel_name;
+        LineBuilder join;
+        join << ':' << user->getPrefix() << " JOIN :" << channel_name;
+        SharedBuffer join_msg = join.finish();
         channel->broadcast(user->getFd(), join_msg, &server);
         user->sendMessage(join_msg);
         if (!channel->getTopic().empty()) {
-            user->sendMessage(":localhost 332 " + user->getNickname() + " " + channel_name + " :" + channel->getTopic());
+            user->sendMessage((LineBuilder() << ":localhost 332 " << user->getNickname() << ' ' << channel_name << " :" << channel->getTopic()).finish());
         } else {
-            user->sendMessage(":localhost 331 " + user->getNickname() + " " + channel_name + " :No topic is set");
+            user->sendMessage((LineBuilder() << ":localhost 331 " << user->getNickname() << ' ' << channel_name << " :No topic is set").finish());
         }
 
-        std::stringstream ss;
-        ss << ":" << server.getServerFd() << " 324 " << user->getNickname() << " " << channel_name << " " << channel->getModeFlags();
-        if (!channel->getPassword().empty()) {
-            ss << " " << channel->getPassword();
-        }
-        if (channel->getUserLimit() > 0) {
-            ss << " " << channel->getUserLimit();
-        }
-        user->sendMessage(ss.str());
-
-        ss.str("");
-        ss << ":localhost 353 " << user->getNickname() << " = " << channel_name << " :";
-        const std::set<int>& users = channel->getUsers();
-        std::set<int>::const_iterator it;
-        for (it = users.begin(); it != users.end(); ++it) {
-            User* channel_user = server.getUser(*it);
-            if (channel_user) {
-                if (channel->isOperator(*it)) {
-                    ss << "@";
+        sendChannelModes(user, *channel, channel_name);
+
+        LineBuilder names;
+        names << ":localhost 353 " << user->getNickname() << " = " << channel_name << " :";
+        const std::vector<Channel::Member>& members = channel->getMembers();
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i].flags & Channel::MEMBER) {
+                if (members[i].flags & Channel::OPERATOR) {
+                    names << '@';
                 }
-                ss << channel_user->getNickname() << " ";
+                names << members[i].user->getNickname() << ' ';
             }
         }
-        user->sendMessage(ss.str());
+        user->sendMessage(names.finish());
 
-        user->sendMessage(":localhost 366 " + user->getNickname() + " " + channel_name + " :End of /NAMES list");
+        user->sendMessage((LineBuilder() << ":localhost 366 " << user->getNickname() << ' ' << channel_name << " :End of /NAMES list").finish());
     }
 }
 
 void CommandHandler::handlePart(User* user, const std::vector<std::string>& args) {
-    if (args.empty()) {
-        user->sendMessage(":server 461 PART :Not enough parameters");
-        return;
-    }
-
     std::vector<std::string> channels = splitByComma(args[0]);
 
     for (std::vector<std::string>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
         std::string channel_name = *it;
         Channel* channel = server.getChannel(channel_name);
         if (!channel) {
-            user->sendMessage(":server 403 " + channel_name + " :No such channel");
+            user->sendMessage((LineBuilder() << ":server 403 " << channel_name << " :No such channel").finish());
             continue;
         }
 
         if (!channel->hasUser(user->getFd())) {
-            user->sendMessage(":server 442 " + channel_name + " :You're not on that channel");
+            user->sendMessage((LineBuilder() << ":server 442 " << channel_name << " :You're not on that channel").finish());
             continue;
         }
 
         if (channel->isLastOperator(user->getFd())) {
-            user->sendMessage(":server 482 " + channel_name + " :You're the last operator on this channel");
+            user->sendMessage((LineBuilder() << ":server 482 " << channel_name << " :You're the last operator on this channel").finish());
             continue;
         }
 
-        std::string part_msg = ":" + user->getNickname() + " PART :" + channel_name;
-        channel->broadcast(user->getFd(), part_msg, &server);
+        channel->broadcast(user->getFd(), (LineBuilder() << ':' << user->getPrefix() << " PART :" << channel_name).finish(), &server);
 
         channel->removeUser(user->getFd());
-        user->leaveChannel(channel_name);
+        user->leaveChannel(channel);
 
         if (channel->isInvited(user->getFd())) {
             channel->removeInvited(user->getFd());
@@ -332,87 +399,60 @@ void CommandHandler::handlePart(User* user, const std::vector<std::string>& args
 
 void CommandHandler::handlePrivmsg(User* user, const std::vector<std::string>& args) {
     if (args.size() < 2) {
-        user->sendMessage(":server 411 :No recipient given");
+        user->sendMessage((LineBuilder() << ":server 411 :No recipient given").finish());
         return;
     }
 
-    std::string target = args[0];
-    std::string message;
-
-    for (size_t i = 1; i < args.size(); ++i) {
-        if (i > 1) message += " ";
-        message += args[i];
-    }
-
-    if (!message.empty() && message[0] == ':') {
-        message = message.substr(1);
-    }
+    const std::string& target = args[0];
+    Channel* channel = NULL;
+    User* target_user = NULL;
 
     if (target[0] == '#' || target[0] == '&') {
-        Channel* channel = server.getChannel(target);
+        channel = server.getChannel(target);
         if (!channel) {
-            user->sendMessage(":server 403 " + target + " :No such channel");
+            user->sendMessage((LineBuilder() << ":server 403 " << target << " :No such channel").finish());
             return;
         }
 
         if (!channel->hasUser(user->getFd())) {
-            user->sendMessage(":server 404 " + target + " :Cannot send to channel");
+            user->sendMessage((LineBuilder() << ":server 404 " << target << " :Cannot send to channel").finish());
             return;
         }
-
-        std::string msg = ":" + user->getNickname() + "!~" + user->getUsername() + "@localhost PRIVMSG " + target + " :" + message;
-        channel->broadcast(user->getFd(), msg, &server);
     } else {
-        const std::map<int, User*>& users = server.getUsers();
-        std::map<int, User*>::const_iterator it;
-        bool found = false;
-
-        for (it = users.begin(); it != users.end(); ++it) {
-            if (it->second->getNickname() == target) {
-                std::string msg = ":" + user->getNickname() + "!~" + user->getUsername() + "@localhost PRIVMSG " + target + " :" + message;
-                it->second->sendMessage(msg);
-                found = true;
-                break;
-            }
+        target_user = server.getUserByNick(target);
+        if (!target_user) {
+            user->sendMessage((LineBuilder() << ":server 401 " << target << " :No such nick").finish());
+            return;
         }
+    }
 
-        if (!found) {
-            user->sendMessage(":server 401 " + target + " :No such nick");
-        }
+    LineBuilder msg;
+    msg << ':' << user->getPrefix() << " PRIVMSG " << target << " :";
+    const std::string& first = args[1];
+    size_t skip = (!first.empty() && first[0] == ':') ? 1 : 0;
+    msg.append(first.data() + skip, first.length() - skip);
+    for (size_t i = 2; i < args.size(); ++i) {
+        msg << ' ' << args[i];
     }
-}
 
+    if (channel) {
+        channel->broadcast(user->getFd(), msg.finish(), &server, OutputQueue::LOW);
+    } else {
+        target_user->sendMessage(msg.finish());
+    }
+}
 
 void CommandHandler::handleQuit(User* user, const std::vector<std::string>& args) {
     std::string reason = args.empty() ? "Client Quit" : args[0];
     if (!reason.empty() && reason[0] == ':') {
         reason = reason.substr(1);
     }
-    std::string quit_msg = ":" + user->getNickname() + " QUIT :" + reason;
-
-    const std::set<std::string>& channels = user->getCurrentChannels();
-    std::set<std::string>::const_iterator it;
-    for (it = channels.begin(); it != channels.end(); ++it) {
-        Channel* channel = server.getChannel(*it);
-        if (channel) {
-            channel->broadcast(user->getFd(), quit_msg, &server);
-            channel->removeUser(user->getFd());
-
-            if (channel->isInvited(user->getFd())) {
-                channel->removeInvited(user->getFd());
-            }
-        }
-    }
+    Channel::broadcastToNeighbors(user, (LineBuilder() << ':' << user->getPrefix() << " QUIT :" << reason).finish(), false);
 
     server.disconnectUser(user->getFd());
 }
 
 void CommandHandler::handleKick(User* user, const std::vector<std::string>& args) {
-    if (args.size() < 2) {
-        user->sendMessage(":server 461 KICK :Not enough parameters");
-        return;
-    }
-
     std::string channel_name = args[0];
     std::string target_nick = args[1];
     std::string reason;
@@ -430,48 +470,41 @@ void CommandHandler::handleKick(User* user, const std::vector<std::string>& args
 
     Channel* channel = server.getChannel(channel_name);
     if (!channel) {
-        user->sendMessage(":server 403 " + channel_name + " :No such channel");
+        user->sendMessage((LineBuilder() << ":server 403 " << channel_name << " :No such channel").finish());
         return;
     }
 
     if (!channel->isOperator(user->getFd())) {
-        user->sendMessage(":server 482 " + channel_name + " :You're not channel operator");
+        user->sendMessage((LineBuilder() << ":server 482 " << channel_name << " :You're not channel operator").finish());
         return;
     }
 
-    const std::map<int, User*>& users = server.getUsers();
-    std::map<int, User*>::const_iterator it;
-    int target_fd = -1;
-
-    for (it = users.begin(); it != users.end(); ++it) {
-        if (it->second->getNickname() == target_nick) {
-            target_fd = it->first;
-            break;
-        }
-    }
+    User* target = server.getUserByNick(target_nick);
+    int target_fd = target ? target->getFd() : -1;
 
     if (target_fd == -1) {
-        user->sendMessage(":server 401 " + target_nick + " :No such nick");
+        user->sendMessage((LineBuilder() << ":server 401 " << target_nick << " :No such nick").finish());
         return;
     }
 
     if (!channel->hasUser(target_fd)) {
-        user->sendMessage(":server 441 " + target_nick + " " + channel_name + " :They aren't on that channel");
+        user->sendMessage((LineBuilder() << ":server 441 " << target_nick << ' ' << channel_name << " :They aren't on that channel").finish());
         return;
     }
 
     if (channel->isLastOperator(target_fd)) {
-        user->sendMessage(":server 482 " + channel_name + " :Cannot kick the last operator from the channel");
+        user->sendMessage((LineBuilder() << ":server 482 " << channel_name << " :Cannot kick the last operator from the channel").finish());
         return;
     }
 
-    std::string kick_msg = ":" + user->getNickname() + " KICK " + channel_name + " " + target_nick + " :" + reason;
-    channel->broadcast(0, kick_msg, &server);
+    LineBuilder kick_msg;
+    kick_msg << ':' << user->getPrefix() << " KICK " << channel_name << ' ' << target_nick << " :" << reason;
+    channel->broadcast(0, kick_msg.finish(), &server);
 
     channel->removeUser(target_fd);
     User* target_user = server.getUser(target_fd);
     if (target_user) {
-        target_user->leaveChannel(channel_name);
+        target_user->leaveChannel(channel);
     }
 
     if (channel->isInvited(target_fd)) {
@@ -480,34 +513,21 @@ void CommandHandler::handleKick(User* user, const std::vector<std::string>& args
 }
 
 void CommandHandler::handleMode(User* user, const std::vector<std::string>& args) {
-    if (args.empty()) {
-        user->sendMessage(":server 461 MODE :Not enough parameters");
-        return;
-    }
-
     std::string target = args[0];
     if (target[0] == '#' || target[0] == '&') {
         Channel* channel = server.getChannel(target);
         if (!channel) {
-            user->sendMessage(":server 403 " + target + " :No such channel");
+            user->sendMessage((LineBuilder() << ":server 403 " << target << " :No such channel").finish());
             return;
         }
 
         if (!channel->isOperator(user->getFd())) {
-            user->sendMessage(":server 482 " + target + " :You're not channel operator");
+            user->sendMessage((LineBuilder() << ":server 482 " << target << " :You're not channel operator").finish());
             return;
         }
 
         if (args.size() < 2) {
-            std::stringstream ss;
-            ss << ":" << server.getServerFd() << " 324 " << user->getNickname() << " " << target << " " << channel->getModeFlags();
-            if (!channel->getPassword().empty()) {
-                ss << " " << channel->getPassword();
-            }
-            if (channel->getUserLimit() > 0) {
-                ss << " " << channel->getUserLimit();
-            }
-            user->sendMessage(ss.str());
+            sendChannelModes(user, *channel, target);
             return;
         }
 
@@ -540,7 +560,7 @@ void CommandHandler::handleMode(User* user, const std::vector<std::string>& args
                         if (args.size() > 2) {
                             channel->setPassword(args[2]);
                         } else {
-                            user->sendMessage(":server 461 MODE k :Not enough parameters");
+                            user->sendMessage((LineBuilder() << ":server 461 MODE k :Not enough parameters").finish());
                             return;
                         }
                     } else {
@@ -550,24 +570,20 @@ void CommandHandler::handleMode(User* user, const std::vector<std::string>& args
 
                 case 'o':
                     if (args.size() > 2) {
-                        const std::map<int, User*>& users = server.getUsers();
-                        std::map<int, User*>::const_iterator it;
-                        for (it = users.begin(); it != users.end(); ++it) {
-                            if (it->second->getNickname() == args[2]) {
-                                if (adding) {
-                                    channel->addOperator(it->first);
-                                } else {
-                                    if (channel->isLastOperator(it->first)) {
-                                        user->sendMessage(":server 482 " + target + " :Cannot remove the last operator from the channel");
-                                        return;
-                                    }
-                                    channel->removeOperator(it->first);
+                        User* member = server.getUserByNick(args[2]);
+                        if (member) {
+                            if (adding) {
+                                channel->addOperator(member->getFd());
+                            } else {
+                                if (channel->isLastOperator(member->getFd())) {
+                                    user->sendMessage((LineBuilder() << ":server 482 " << target << " :Cannot remove the last operator from the channel").finish());
+                                    return;
                                 }
-                                break;
+                                channel->removeOperator(member->getFd());
                             }
                         }
                     } else {
-                        user->sendMessage(":server 461 MODE o :Not enough parameters");
+                        user->sendMessage((LineBuilder() << ":server 461 MODE o :Not enough parameters").finish());
                         return;
                     }
                     break;
@@ -580,7 +596,7 @@ void CommandHandler::handleMode(User* user, const std::vector<std::string>& args
                                 channel->setUserLimit(limit);
                             }
                         } else {
-                            user->sendMessage(":server 461 MODE l :Not enough parameters");
+                            user->sendMessage((LineBuilder() << ":server 461 MODE l :Not enough parameters").finish());
                             return;
                         }
                     } else {
@@ -590,62 +606,71 @@ void CommandHandler::handleMode(User* user, const std::vector<std::string>& args
             }
         }
 
-        std::string mode_msg = ":" + user->getNickname() + " MODE " + target + " " + modes;
+        LineBuilder mode_msg;
+        mode_msg << ':' << user->getPrefix() << " MODE " << target << ' ' << modes;
         if (args.size() > 2 && !hasPasswordMode) {
-            mode_msg += " " + args[2];
+            mode_msg << ' ' << args[2];
         }
-        channel->broadcast(0, mode_msg, &server);
+        channel->broadcast(0, mode_msg.finish(), &server);
     } else {
         if (target != user->getNickname()) {
-            user->sendMessage(":server 502 :Cannot change mode for other users");
+            user->sendMessage((LineBuilder() << ":server 502 :Cannot change mode for other users").finish());
             return;
         }
 
         if (args.size() < 2) {
-            std::stringstream ss;
-            ss << ":" << server.getServerFd() << " 221 " << user->getNickname() << " " << user->getModeFlags();
-            user->sendMessage(ss.str());
+            LineBuilder reply;
+            reply << ':' << server.getServerFd() << " 221 " << user->getNickname() << ' ' << user->getModeFlags();
+            user->sendMessage(reply.finish());
             return;
         }
 
-        std::string modes = args[1];
+        // Operator status only comes from OPER; +o is ignored as RFC 2812 asks.
+        std::string modes;
+        bool adding = true;
+        for (size_t i = 0; i < args[1].length(); ++i) {
+            char flag = args[1][i];
+            if (flag == '+' || flag == '-') {
+                adding = (flag == '+');
+            } else if (flag == 'o' && adding) {
+                continue;
+            }
+            modes += flag;
+        }
+        if (modes.find_first_not_of("+-") == std::string::npos) {
+            return;
+        }
         user->setModeFlags(modes);
 
-        std::string mode_msg = ":" + user->getNickname() + " MODE " + target + " " + modes;
-        user->sendMessage(mode_msg);
+        user->sendMessage((LineBuilder() << ':' << user->getPrefix() << " MODE " << target << ' ' << modes).finish());
     }
 }
 
 void CommandHandler::handleTopic(User* user, const std::vector<std::string>& args) {
-    if (args.empty()) {
-        user->sendMessage(":server 461 TOPIC :Not enough parameters");
-        return;
-    }
-
     std::string channel_name = args[0];
     Channel* channel = server.getChannel(channel_name);
     if (!channel) {
-        user->sendMessage(":server 403 " + channel_name + " :No such channel");
+        user->sendMessage((LineBuilder() << ":server 403 " << channel_name << " :No such channel").finish());
         return;
     }
 
     if (!channel->hasUser(user->getFd())) {
-        user->sendMessage(":server 442 " + channel_name + " :You're not on that channel");
+        user->sendMessage((LineBuilder() << ":server 442 " << channel_name << " :You're not on that channel").finish());
         return;
     }
 
     if (args.size() < 2) {
         std::string topic = channel->getTopic();
         if (topic.empty()) {
-            user->sendMessage(":server 331 " + user->getNickname() + " " + channel_name + " :No topic is set");
+            user->sendMessage((LineBuilder() << ":server 331 " << user->getNickname() << ' ' << channel_name << " :No topic is set").finish());
         } else {
-            user->sendMessage(":server 332 " + user->getNickname() + " " + channel_name + " :" + topic);
+            user->sendMessage((LineBuilder() << ":server 332 " << user->getNickname() << ' ' << channel_name << " :" << topic).finish());
         }
         return;
     }
 
     if (channel->isTopicRestricted() && !channel->isOperator(user->getFd())) {
-        user->sendMessage(":server 482 " + channel_name + " :You're not channel operator");
+        user->sendMessage((LineBuilder() << ":server 482 " << channel_name << " :You're not channel operator").finish());
         return;
     }
 
@@ -655,76 +680,132 @@ void CommandHandler::handleTopic(User* user, const std::vector<std::string>& arg
     }
     channel->setTopic(new_topic);
 
-    std::string topic_msg = ":" + user->getNickname() + " TOPIC " + channel_name + " :" + new_topic;
-    channel->broadcast(0, topic_msg, &server);
+    channel->broadcast(0, (LineBuilder() << ':' << user->getPrefix() << " TOPIC " << channel_name << " :" << new_topic).finish(), &server);
 }
 
 void CommandHandler::handleInvite(User* user, const std::vector<std::string>& args) {
-    if (args.size() < 2) {
-        user->sendMessage(":server 461 INVITE :Not enough parameters");
-        return;
-    }
-
     std::string target_nick = args[0];
     std::string channel_name = args[1];
 
     Channel* channel = server.getChannel(channel_name);
     if (!channel) {
-        user->sendMessage(":server 403 " + channel_name + " :No such channel");
+        user->sendMessage((LineBuilder() << ":server 403 " << channel_name << " :No such channel").finish());
         return;
     }
 
     if (!channel->hasUser(user->getFd())) {
-        user->sendMessage(":server 442 " + channel_name + " :You're not on that channel");
+        user->sendMessage((LineBuilder() << ":server 442 " << channel_name << " :You're not on that channel").finish());
         return;
     }
 
-    const std::map<int, User*>& users = server.getUsers();
-    std::map<int, User*>::const_iterator it;
-    int target_fd = -1;
-
-    for (it = users.begin(); it != users.end(); ++it) {
-        if (it->second->getNickname() == target_nick) {
-            target_fd = it->first;
-            break;
-        }
-    }
+    User* target = server.getUserByNick(target_nick);
+    int target_fd = target ? target->getFd() : -1;
 
     if (target_fd == -1) {
-        user->sendMessage(":server 401 " + target_nick + " :No such nick");
+        user->sendMessage((LineBuilder() << ":server 401 " << target_nick << " :No such nick").finish());
         return;
     }
 
     if (channel->hasUser(target_fd)) {
-        user->sendMessage(":server 443 " + target_nick + " " + channel_name + " :is already on channel");
+        user->sendMessage((LineBuilder() << ":server 443 " << target_nick << ' ' << channel_name << " :is already on channel").finish());
         return;
     }
 
     channel->addInvited(target_fd);
 
-    std::string invite_msg = ":" + user->getNickname() + " INVITE " + target_nick + " :" + channel_name;
     User* target_user = server.getUser(target_fd);
     if (target_user) {
-        target_user->sendMessage(invite_msg);
+        target_user->sendMessage((LineBuilder() << ':' << user->getPrefix() << " INVITE " << target_nick << " :" << channel_name).finish());
     }
 
-    user->sendMessage(":server 341 " + user->getNickname() + " " + target_nick + " " + channel_name);
+    user->sendMessage((LineBuilder() << ":server 341 " << user->getNickname() << ' ' << target_nick << ' ' << channel_name).finish());
 }
 
-void CommandHandler::handlePass(User* user, const std::vector<std::string>& args) {
-    if (args.empty()) {
-        user->sendMessage(":server 461 * PASS :Not enough parameters");
+void CommandHandler::handlePing(User* user, const std::vector<std::string>& args) {
+    if (!args.empty()) {
+        user->sendMessage((LineBuilder() << ":localhost PONG :" << args[0]).finish());
+    } else {
+        user->sendMessage((LineBuilder() << ":localhost PONG :").finish());
+    }
+}
+
+void CommandHandler::handlePong(User* user, const std::vector<std::string>& args) {
+    (void)user;
+    (void)args;
+}
+
+// There is a single operator password; the name is accepted as given.
+void CommandHandler::handleOper(User* user, const std::vector<std::string>& args) {
+    const std::string& password = server.getOperPassword();
+    if (password.empty()) {
+        user->sendMessage((LineBuilder() << ":server 491 " << user->getNickname() << " :No O-lines for your host").finish());
         return;
     }
+    if (args[1] != password) {
+        user->sendMessage((LineBuilder() << ":server 464 " << user->getNickname() << " :Password incorrect").finish());
+        return;
+    }
+
+    user->setOperator(true);
+    user->sendMessage((LineBuilder() << ":server 381 " << user->getNickname() << " :You are now an IRC operator").finish());
+    user->sendMessage((LineBuilder() << ':' << user->getPrefix() << " MODE " << user->getNickname() << " +o").finish());
+}
 
+// STATS m lists per-command counters, with the lines sent in reply and
+// the handler CPU time in microseconds where RFC 2812 has byte and
+// remote counts. STATS u is the uptime and STATS z the full metrics set,
+// one "name{labels} value" line each, as served to Prometheus.
+void CommandHandler::handleStats(User* user, const std::vector<std::string>& args) {
+    const std::string& nick = user->getNickname();
+    if (!user->isOperator()) {
+        user->sendMessage((LineBuilder() << ":server 481 " << nick << " :Permission Denied- You're not an IRC operator").finish());
+        return;
+    }
+
+    char query = args.empty() || args[0].empty() ? '*' : args[0][0];
+    if (query == 'm') {
+        std::vector<Command> totals;
+        totalCommands(server.getCommandHandlers(), totals);
+        for (size_t i = 0; i < totals.size(); ++i) {
+            const Command& entry = totals[i];
+            if (entry.linesIn == 0) {
+                continue;
+            }
+            LineBuilder reply;
+            reply << ":server 212 " << nick << ' ' << entry.name << ' ' << static_cast<size_t>(entry.linesIn)
+                  << ' ' << static_cast<size_t>(entry.linesOut) << ' ' << static_cast<size_t>(entry.cpuNs / 1000);
+            user->sendMessage(reply.finish());
+        }
+    } else if (query == 'u') {
+        size_t uptime = server.getUptime();
+        size_t minutes = (uptime / 60) % 60;
+        size_t seconds = uptime % 60;
+        LineBuilder reply;
+        reply << ":server 242 " << nick << " :Server Up " << uptime / 86400 << " days " << (uptime / 3600) % 24 << ':'
+              << (minutes < 10 ? "0" : "") << minutes << ':' << (seconds < 10 ? "0" : "") << seconds;
+        user->sendMessage(reply.finish());
+    } else if (query == 'z') {
+        Metrics metrics;
+        server.collectMetrics(metrics);
+        std::vector<std::string> lines;
+        metrics.lines(lines);
+        for (size_t i = 0; i < lines.size(); ++i) {
+            user->sendMessage((LineBuilder() << ":server 249 " << nick << " z :" << lines[i]).finish());
+        }
+    }
+
+    user->sendMessage((LineBuilder() << ":server 219 " << nick << ' ' << query << " :End of STATS report").finish());
+}
+
+void CommandHandler::handlePass(User* user, const std::vector<std::string>& args) {
     if (user->isAuthenticated()) {
-        user->sendMessage(":server 462 * :You may not reregister");
+        user->sendMessage((LineBuilder() << ":server 462 * :You may not reregister").finish());
         return;
     }
 
     if (args[0] == server.getPassword()) {
         user->setAuthenticated(true);
     } else {
-        user->sendMessage(":server 464 * :Password incorrect");
+        user->sendMessage((LineBuilder() << ":server 464 * :Password incorrect").finish());
     }
 }
@@ -4,13 +4,77 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <iomanip>
 #include <algorithm>
 #include "User.hpp"
 #include "Server.hpp"
+#include "IrcMessage.hpp"
+#include "LineBuilder.hpp"
+#include "Metrics.hpp"
 
 class CommandHandler {
+public:
+    enum Access {
+        ANYONE,
+        AUTHENTICATED,
+        REGISTERED
+    };
+
+    enum {
+        CPU_SAMPLE_INTERVAL = 64
+    };
+
+    typedef void (CommandHandler::*Handler)(User* user, const std::vector<std::string>& args);
+
+    struct Command {
+        const char* name;
+        Handler handler;
+        size_t minParams;
+        Access access;
+        int floodCost;
+        Server::StateGuard::Mode locking;
+        unsigned long long calls;
+        unsigned long long cpuNs;
+        unsigned long long linesIn;
+        unsigned long long linesOut;
+        LatencyHistogram latency;
+    };
+
 private:
+    enum CommandId {
+        CMD_PASS,
+        CMD_NICK,
+        CMD_USER,
+        CMD_JOIN,
+        CMD_PART,
+        CMD_PRIVMSG,
+        CMD_QUIT,
+        CMD_KICK,
+        CMD_MODE,
+        CMD_TOPIC,
+        CMD_INVITE,
+        CMD_PING,
+        CMD_PONG,
+        CMD_OPER,
+        CMD_STATS,
+        CMD_COUNT,
+        CMD_UNKNOWN = CMD_COUNT
+    };
+
     Server& server;
+    Command commands[CMD_COUNT + 1];
+    IrcMessage message;
+    std::string token;
+    std::vector<std::string> arguments;
+
+    CommandHandler(const CommandHandler& other);
+    CommandHandler& operator=(const CommandHandler& other);
+
+    void execute(User* user, Command& entry, const std::string& command, const std::vector<std::string>& args);
+    void dispatch(User* user, Command& entry, const std::string& command, const std::vector<std::string>& args);
+    void define(CommandId id, const char* name, Handler handler, size_t minParams, Access access, int floodCost,
+                Server::StateGuard::Mode locking);
+    static CommandId lookup(const std::string& command);
 
     void handleNick(User* user, const std::vector<std::string>& args);
     void handleUser(User* user, const std::vector<std::string>& args);
@@ -23,17 +87,23 @@ private:
     void handleTopic(User* user, const std::vector<std::string>& args);
     void handleInvite(User* user, const std::vector<std::string>& args);
     void handlePass(User* user, const std::vector<std::string>& args);
-    std::vector<std::string> splitMessage(const std::string& message);
-    std::vector<std::string> splitByComma(const std::string& str);
+    void handlePing(User* user, const std::vector<std::string>& args);
+    void handlePong(User* user, const std::vector<std::string>& args);
+    void handleOper(User* user, const std::vector<std::string>& args);
+    void handleStats(User* user, const std::vector<std::string>& args);
     bool isValidNickname(const std::string& nickname);
     bool isValidChannelName(const std::string& channel);
     bool isUserAuthenticated(User* user);
     bool isUserRegistered(User* user);
+    void sendChannelModes(User* user, Channel& channel, const std::string& name);
 
 public:
     CommandHandler(Server& server);
-    void parseMessage(User* user, const std::string& message);
+    int parseMessage(User* user, const char* line, size_t length);
     void executeCommand(User* user, const std::string& command, const std::vector<std::string>& args);
+    const Command* getCommands(size_t& count) const;
+    static void totalCommands(const std::vector<CommandHandler*>& handlers, std::vector<Command>& totals);
+    static std::vector<std::string> splitByComma(const std::string& str);
 };
 
 #endif
@@ -0,0 +1,73 @@
+#include "ConnectionTable.hpp"
+#include "User.hpp"
+
+ConnectionTable::ConnectionTable(size_t capacity) {
+    Slot empty;
+    empty.user = NULL;
+    empty.generation = 0;
+    empty.index = 0;
+    slots.assign(capacity, empty);
+}
+
+bool ConnectionTable::insert(User* user) {
+    int fd = user->getFd();
+    if (fd < 0 || fd >= (int)slots.size() || slots[fd].user) {
+        return false;
+    }
+
+    slots[fd].user = user;
+    slots[fd].index = live.size();
+    live.push_back(user);
+    user->setGeneration(slots[fd].generation);
+    return true;
+}
+
+User* ConnectionTable::remove(int fd) {
+    if (fd < 0 || fd >= (int)slots.size() || !slots[fd].user) {
+        return NULL;
+    }
+
+    User* user = slots[fd].user;
+    size_t index = slots[fd].index;
+    User* moved = live.back();
+    live[index] = moved;
+    slots[moved->getFd()].index = index;
+    live.pop_back();
+
+    slots[fd].user = NULL;
+    slots[fd].generation++;
+    return user;
+}
+
+User* ConnectionTable::get(int fd) const {
+    if (fd < 0 || fd >= (int)slots.size()) {
+        return NULL;
+    }
+    return slots[fd].user;
+}
+
+User* ConnectionTable::get(int fd, unsigned int generation) const {
+    if (fd < 0 || fd >= (int)slots.size() || slots[fd].generation != generation) {
+        return NULL;
+    }
+    return slots[fd].user;
+}
+
+unsigned int ConnectionTable::getGeneration(int fd) const {
+    if (fd < 0 || fd >= (int)slots.size()) {
+        return 0;
+    }
+    return slots[fd].generation;
+}
+
+const std::vector<User*>& ConnectionTable::getAll() const {
+    return live;
+}
+
+size_t ConnectionTable::size() const {
+    return live.size();
+}
+
+size_t ConnectionTable::capacity() const {
+    return slots.size();
+}
@@ -0,0 +1,42 @@
+#ifndef CONNECTION_TABLE_HPP
+#define CONNECTION_TABLE_HPP
+
+#include <vector>
+#include <cstddef>
+
+class User;
+
+// Fd-indexed slab of connections. The slot array is sized once from
+// RLIMIT_NOFILE and never reallocated, so a reactor may read the slots of
+// its own descriptors without holding the state lock. Each slot carries a
+// generation that changes whenever the descriptor is released, which lets
+// deferred work tell a reused fd from the connection it was meant for.
+class ConnectionTable {
+private:
+    struct Slot {
+        User* user;
+        unsigned int generation;
+        size_t index;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<User*> live;
+
+    ConnectionTable(const ConnectionTable& other);
+    ConnectionTable& operator=(const ConnectionTable& other);
+
+public:
+    ConnectionTable(size_t capacity);
+
+    bool insert(User* user);
+    User* remove(int fd);
+    User* get(int fd) const;
+    User* get(int fd, unsigned int generation) const;
+    unsigned int getGeneration(int fd) const;
+
+    const std::vector<User*>& getAll() const;
+    size_t size() const;
+    size_t capacity() const;
+};
+
+#endif
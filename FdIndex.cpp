@@ -0,0 +1,82 @@
+#include "FdIndex.hpp"
+
+static const int EMPTY = -1;
+
+FdIndex::FdIndex() : count(0) {
+    Slot empty;
+    empty.fd = EMPTY;
+    empty.position = 0;
+    slots.assign(8, empty);
+}
+
+size_t FdIndex::home(int fd) const {
+    return (static_cast<unsigned int>(fd) * 2654435761u) & (slots.size() - 1);
+}
+
+bool FdIndex::find(int fd, size_t& position) const {
+    for (size_t i = home(fd); slots[i].fd != EMPTY; i = (i + 1) & (slots.size() - 1)) {
+        if (slots[i].fd == fd) {
+            position = slots[i].position;
+            return true;
+        }
+    }
+    return false;
+}
+
+void FdIndex::set(int fd, size_t position) {
+    size_t i = home(fd);
+    for (; slots[i].fd != EMPTY; i = (i + 1) & (slots.size() - 1)) {
+        if (slots[i].fd == fd) {
+            slots[i].position = position;
+            return;
+        }
+    }
+    slots[i].fd = fd;
+    slots[i].position = position;
+    if (++count * 2 > slots.size()) {
+        grow();
+    }
+}
+
+void FdIndex::erase(int fd) {
+    size_t mask = slots.size() - 1;
+    size_t i = home(fd);
+    while (slots[i].fd != fd) {
+        if (slots[i].fd == EMPTY) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    // Pull later entries of the probe run back into the hole so that no
+    // lookup ever stops early at it.
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; slots[j].fd != EMPTY; j = (j + 1) & mask) {
+        size_t want = home(slots[j].fd);
+        if (((j - want) & mask) >= ((j - hole) & mask)) {
+            slots[hole] = slots[j];
+            hole = j;
+        }
+    }
+    slots[hole].fd = EMPTY;
+    count--;
+}
+
+void FdIndex::grow() {
+    std::vector<Slot> old;
+    old.swap(slots);
+    Slot empty;
+    empty.fd = EMPTY;
+    empty.position = 0;
+    slots.assign(old.size() * 2, empty);
+    count = 0;
+    for (size_t i = 0; i < old.size(); ++i) {
+        if (old[i].fd != EMPTY) {
+            set(old[i].fd, old[i].position);
+        }
+    }
+}
+
+size_t FdIndex::size() const {
+    return count;
+}
@@ -0,0 +1,32 @@
+#ifndef FD_INDEX_HPP
+#define FD_INDEX_HPP
+
+#include <vector>
+#include <cstddef>
+
+// Open-addressing map from descriptor to a position in some dense array.
+// Linear probing with backward-shift deletion keeps lookups, inserts and
+// removals O(1) without tombstones.
+class FdIndex {
+private:
+    struct Slot {
+        int fd;
+        size_t position;
+    };
+
+    std::vector<Slot> slots;
+    size_t count;
+
+    size_t home(int fd) const;
+    void grow();
+
+public:
+    FdIndex();
+
+    bool find(int fd, size_t& position) const;
+    void set(int fd, size_t position);
+    void erase(int fd);
+    size_t size() const;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "Histogram.hpp"
+
+Histogram::Histogram() : sum(0) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] = 0;
+    }
+}
+
+void Histogram::record(unsigned long long value) {
+    int bucket = (value <= 1) ? 0 : 64 - __builtin_clzll(value - 1);
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+    counts[bucket]++;
+    sum += value;
+}
+
+void Histogram::merge(const Histogram& other) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] += other.counts[i];
+    }
+    sum += other.sum;
+}
+
+unsigned long Histogram::count(int bucket) const {
+    return counts[bucket];
+}
+
+unsigned long long Histogram::total() const {
+    unsigned long long result = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        result += counts[i];
+    }
+    return result;
+}
+
+unsigned long long Histogram::getSum() const {
+    return sum;
+}
+
+// The last bucket is unbounded; callers render it as +Inf.
+unsigned long long Histogram::upperBound(int bucket) {
+    return 1ULL << bucket;
+}
@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+// Distribution of non-negative values in power-of-two buckets: bucket b
+// holds values up to 2^b, the last one everything larger. Recording is a
+// count-leading-zeros and two increments, so it can sit on hot paths.
+// Like the other per-reactor stats it is only written by its own reactor;
+// readers sum reactors with merge() and accept slightly stale counts.
+class Histogram {
+public:
+    enum {
+        BUCKETS = 24
+    };
+
+private:
+    unsigned long counts[BUCKETS];
+    unsigned long long sum;
+
+public:
+    Histogram();
+
+    void record(unsigned long long value);
+    void merge(const Histogram& other);
+
+    unsigned long count(int bucket) const;
+    unsigned long long total() const;
+    unsigned long long getSum() const;
+    static unsigned long long upperBound(int bucket);
+};
+
+#endif
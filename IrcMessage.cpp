@@ -0,0 +1,87 @@
+#include "IrcMessage.hpp"
+#include <cstring>
+
+StringRef::StringRef() : data(NULL), length(0) {
+}
+
+StringRef::StringRef(const char* data, size_t length) : data(data), length(length) {
+}
+
+bool StringRef::empty() const {
+    return length == 0;
+}
+
+bool StringRef::equals(const char* text) const {
+    return std::strlen(text) == length && std::memcmp(data, text, length) == 0;
+}
+
+std::string StringRef::str() const {
+    return std::string(data, length);
+}
+
+IrcMessage::IrcMessage() : paramCount(0), trailing(false) {
+}
+
+static const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    return p;
+}
+
+static const char* scanToken(const char* p, const char* end, StringRef& token) {
+    const char* space = static_cast<const char*>(std::memchr(p, ' ', end - p));
+    if (!space) {
+        space = end;
+    }
+    token = StringRef(p, space - p);
+    return space;
+}
+
+bool IrcMessage::parse(const char* line, size_t length, IrcMessage& message) {
+    const char* p = line;
+    const char* end = line + length;
+
+    message.tags = StringRef();
+    message.prefix = StringRef();
+    message.command = StringRef();
+    message.paramCount = 0;
+    message.trailing = false;
+
+    p = skipSpaces(p, end);
+    if (p < end && *p == '@') {
+        p = skipSpaces(scanToken(p + 1, end, message.tags), end);
+    }
+    if (p < end && *p == ':') {
+        p = skipSpaces(scanToken(p + 1, end, message.prefix), end);
+    }
+    if (p == end) {
+        return false;
+    }
+    p = scanToken(p, end, message.command);
+
+    while ((p = skipSpaces(p, end)) < end) {
+        if (*p == ':') {
+            message.params[message.paramCount++] = StringRef(p + 1, end - p - 1);
+            message.trailing = true;
+            break;
+        }
+        if (message.paramCount == MAX_PARAMS - 1) {
+            message.params[message.paramCount++] = StringRef(p, end - p);
+            break;
+        }
+        p = scanToken(p, end, message.params[message.paramCount++]);
+    }
+    return true;
+}
+
+void IrcMessage::copyParams(std::vector<std::string>& args) const {
+    args.resize(paramCount);
+    for (int i = 0; i < paramCount; ++i) {
+        if (trailing && i == paramCount - 1) {
+            args[i].assign(1, ':').append(params[i].data, params[i].length);
+        } else {
+            args[i].assign(params[i].data, params[i].length);
+        }
+    }
+}
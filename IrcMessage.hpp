@@ -0,0 +1,47 @@
+#ifndef IRC_MESSAGE_HPP
+#define IRC_MESSAGE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Non-owning view of a byte range inside a received line.
+struct StringRef {
+    const char* data;
+    size_t length;
+
+    StringRef();
+    StringRef(const char* data, size_t length);
+
+    bool empty() const;
+    bool equals(const char* text) const;
+    std::string str() const;
+};
+
+// One parsed RFC 1459 / IRCv3 message. Every field points into the line
+// that was parsed, so the message is only valid while that line is, and
+// parsing never touches the heap.
+struct IrcMessage {
+    enum {
+        MAX_PARAMS = 15
+    };
+
+    StringRef tags;
+    StringRef prefix;
+    StringRef command;
+    StringRef params[MAX_PARAMS];
+    int paramCount;
+    bool trailing;
+
+    IrcMessage();
+
+    // [ "@" tags SP ] [ ":" prefix SP ] command *14( SP middle ) [ SP [ ":" ] trailing ]
+    // Returns false when the line holds no command.
+    static bool parse(const char* line, size_t length, IrcMessage& message);
+
+    // Copies the params into args, reusing the strings already there. A
+    // trailing param keeps its leading ':' as the command handlers expect.
+    void copyParams(std::vector<std::string>& args) const;
+};
+
+#endif
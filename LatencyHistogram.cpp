@@ -0,0 +1,88 @@
+#include "LatencyHistogram.hpp"
+#include <time.h>
+
+LatencyHistogram::LatencyHistogram() : total(0), sum(0), max(0) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] = 0;
+    }
+}
+
+// Values below 2 * SUB_BUCKETS map to themselves; above that, the index is
+// the value's top SUB_BITS + 1 bits offset by how far they were shifted.
+int LatencyHistogram::indexOf(unsigned long long value) {
+    if (value < 2 * SUB_BUCKETS) {
+        return static_cast<int>(value);
+    }
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    int index = shift * SUB_BUCKETS + static_cast<int>(value >> shift);
+    return (index < BUCKETS) ? index : BUCKETS - 1;
+}
+
+unsigned long long LatencyHistogram::highestEquivalent(int index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    unsigned long long sub = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(unsigned long long ns) {
+    counts[indexOf(ns)]++;
+    total++;
+    sum += ns;
+    if (ns > max) {
+        max = ns;
+    }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    if (other.max > max) {
+        max = other.max;
+    }
+}
+
+unsigned long long LatencyHistogram::count() const {
+    return total;
+}
+
+unsigned long long LatencyHistogram::getSum() const {
+    return sum;
+}
+
+unsigned long long LatencyHistogram::getMax() const {
+    return max;
+}
+
+// Upper edge of the bucket holding the given fraction of samples, capped
+// at the largest value seen.
+unsigned long long LatencyHistogram::percentile(double fraction) const {
+    if (total == 0) {
+        return 0;
+    }
+    double target = fraction * total;
+    unsigned long long rank = static_cast<unsigned long long>(target);
+    if (rank < target || rank == 0) {
+        rank++;
+    }
+    unsigned long long seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            unsigned long long value = highestEquivalent(i);
+            return (value < max) ? value : max;
+        }
+    }
+    return max;
+}
+
+unsigned long long LatencyHistogram::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,43 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+// Log-linear histogram of durations in nanoseconds, in the style of
+// HdrHistogram: every power of two is split into SUB_BUCKETS linear
+// buckets, so any recorded value is known to within 1/16 of itself from
+// 1 ns up to about 18 minutes, in under 5 KB. Recording is one
+// count-leading-zeros, a shift and two increments. Like Histogram it is
+// written only by its owner; readers merge() copies and accept counts
+// that are slightly behind.
+class LatencyHistogram {
+public:
+    enum {
+        SUB_BITS = 4,
+        SUB_BUCKETS = 1 << SUB_BITS,
+        MAX_BITS = 40,
+        BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS
+    };
+
+private:
+    unsigned long counts[BUCKETS];
+    unsigned long long total;
+    unsigned long long sum;
+    unsigned long long max;
+
+    static int indexOf(unsigned long long value);
+    static unsigned long long highestEquivalent(int index);
+
+public:
+    LatencyHistogram();
+
+    void record(unsigned long long ns);
+    void merge(const LatencyHistogram& other);
+
+    unsigned long long count() const;
+    unsigned long long getSum() const;
+    unsigned long long getMax() const;
+    unsigned long long percentile(double fraction) const;
+
+    static unsigned long long now();
+};
+
+#endif
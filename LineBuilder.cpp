@@ -0,0 +1,52 @@
+#include "LineBuilder.hpp"
+#include <cstring>
+
+LineBuilder::LineBuilder() : line(SharedBuffer::acquire()), out(&line.buffer()) {
+}
+
+LineBuilder& LineBuilder::append(const char* data, size_t length) {
+    out->append(data, length);
+    return *this;
+}
+
+LineBuilder& LineBuilder::operator<<(const std::string& text) {
+    out->append(text);
+    return *this;
+}
+
+LineBuilder& LineBuilder::operator<<(const char* text) {
+    out->append(text, strlen(text));
+    return *this;
+}
+
+LineBuilder& LineBuilder::operator<<(char c) {
+    out->push_back(c);
+    return *this;
+}
+
+LineBuilder& LineBuilder::operator<<(int value) {
+    if (value < 0) {
+        out->push_back('-');
+        return *this << static_cast<size_t>(-static_cast<long>(value));
+    }
+    return *this << static_cast<size_t>(value);
+}
+
+LineBuilder& LineBuilder::operator<<(size_t value) {
+    char digits[24];
+    size_t pos = sizeof(digits);
+    do {
+        digits[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    out->append(digits + pos, sizeof(digits) - pos);
+    return *this;
+}
+
+SharedBuffer LineBuilder::finish() {
+    out->append("\r\n", 2);
+    SharedBuffer done = line;
+    line = SharedBuffer();
+    out = NULL;
+    return done;
+}
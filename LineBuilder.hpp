@@ -0,0 +1,32 @@
+#ifndef LINE_BUILDER_HPP
+#define LINE_BUILDER_HPP
+
+#include <string>
+#include <cstddef>
+#include "SharedBuffer.hpp"
+
+// Serializes one outgoing line straight into a pooled SharedBuffer, so a
+// reply is formatted without intermediate strings or stream objects.
+class LineBuilder {
+private:
+    SharedBuffer line;
+    std::string* out;
+
+    LineBuilder(const LineBuilder&);
+    LineBuilder& operator=(const LineBuilder&);
+
+public:
+    LineBuilder();
+
+    LineBuilder& append(const char* data, size_t length);
+    LineBuilder& operator<<(const std::string& text);
+    LineBuilder& operator<<(const char* text);
+    LineBuilder& operator<<(char c);
+    LineBuilder& operator<<(int value);
+    LineBuilder& operator<<(size_t value);
+
+    // Terminates the line with CRLF and hands the buffer over.
+    SharedBuffer finish();
+};
+
+#endif
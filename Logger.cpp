@@ -0,0 +1,348 @@
+#include "Logger.hpp"
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <vector>
+
+Logger::Level Logger::threshold = Logger::INFO;
+bool Logger::running = false;
+bool Logger::stopping = false;
+pthread_t Logger::thread;
+pthread_mutex_t Logger::lock = PTHREAD_MUTEX_INITIALIZER;
+Logger::Ring* Logger::rings = NULL;
+unsigned long long Logger::written = 0;
+unsigned long long Logger::reported_drops = 0;
+
+static __thread Logger::Ring* local_ring = NULL;
+
+static const char* const LEVEL_NAMES[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+// Rings outlive their threads: a reactor that exits may still have
+// records waiting. The list is only ever prepended to, with a CAS, so
+// readers walk it without a lock.
+Logger::Ring* Logger::localRing() {
+    if (!local_ring) {
+        Ring* ring = new Ring();
+        ring->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        }
+        local_ring = ring;
+    }
+    return local_ring;
+}
+
+void Logger::start() {
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&stopping, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, writerThread, NULL) != 0) {
+        __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    }
+}
+
+// Must be called once every other thread that logs has been joined:
+// after it returns, records are written synchronously again.
+void Logger::stop() {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    drain();
+}
+
+bool Logger::setLevel(const std::string& name) {
+    static const char* const names[] = { "debug", "info", "warn", "error" };
+    for (int i = DEBUG; i <= ERROR; ++i) {
+        if (name == names[i]) {
+            threshold = static_cast<Level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Logger::enabled(Level level) {
+    return level >= threshold;
+}
+
+// Lock-free, so the metrics endpoint never waits on a blocked writer.
+Logger::Stats Logger::getStats() {
+    Stats stats;
+    stats.written = __atomic_load_n(&written, __ATOMIC_RELAXED);
+    stats.dropped = 0;
+    stats.suppressed = 0;
+    for (Ring* ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        stats.dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        stats.suppressed += __atomic_load_n(&ring->suppressed, __ATOMIC_RELAXED);
+    }
+    return stats;
+}
+
+// Events are keyed by the address of their name, which is always a
+// literal. A full table lets everything through rather than guess.
+bool Logger::admit(const char* event, time_t now, unsigned long& suppressed) {
+    Ring* ring = localRing();
+    size_t start = (reinterpret_cast<size_t>(event) >> 3) % RATE_SLOTS;
+    suppressed = 0;
+    for (size_t probe = 0; probe < 8; ++probe) {
+        RateSlot& slot = ring->slots[(start + probe) % RATE_SLOTS];
+        if (slot.event && slot.event != event) {
+            continue;
+        }
+        if (slot.event != event || slot.window != now) {
+            suppressed = slot.suppressed;
+            slot.event = event;
+            slot.window = now;
+            slot.count = 0;
+            slot.suppressed = 0;
+        }
+        if (++slot.count <= RATE_LIMIT) {
+            return true;
+        }
+        slot.suppressed++;
+        __atomic_store_n(&ring->suppressed, ring->suppressed + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+void Logger::submit(Level level, unsigned long long time_ns, const char* text, size_t length) {
+    Record* record;
+    Record sync_record;
+    Ring* ring = NULL;
+    bool async = __atomic_load_n(&running, __ATOMIC_ACQUIRE);
+
+    if (async) {
+        ring = localRing();
+        size_t head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        record = &ring->records[head % RING_SIZE];
+    } else {
+        record = &sync_record;
+    }
+
+    record->time_ns = time_ns;
+    record->level = level;
+    record->length = static_cast<unsigned int>(length);
+    std::memcpy(record->text, text, length);
+
+    if (async) {
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+        return;
+    }
+    char line[TEXT_SIZE + 64];
+    size_t size = format(*record, line);
+    writeAll(level >= WARN ? STDERR_FILENO : STDOUT_FILENO, line, size);
+    __atomic_add_fetch(&written, 1, __ATOMIC_RELAXED);
+}
+
+size_t Logger::format(const Record& record, char* out) {
+    time_t seconds = static_cast<time_t>(record.time_ns / 1000000000ULL);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    size_t size = strftime(out, 32, "%Y-%m-%d %H:%M:%S", &local);
+    size += std::sprintf(out + size, ".%03u %s ", static_cast<unsigned int>(record.time_ns / 1000000 % 1000),
+                         LEVEL_NAMES[record.level]);
+    std::memcpy(out + size, record.text, record.length);
+    size += record.length;
+    out[size++] = '\n';
+    return size;
+}
+
+void Logger::writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+// Moves everything published so far out of the rings under the lock,
+// which only keeps two drains apart, so producers get their slots back at
+// once. Formatting and the write(2)s, one per stream and batch, happen
+// after it is released; nothing on an event loop ever waits on them.
+// Returns whether a ring was found full enough that the writer should
+// come straight back.
+bool Logger::drain() {
+    enum { BATCH = 65536 };
+    static std::vector<Record> taken;
+    static char out[2][BATCH];
+    size_t used[2] = { 0, 0 };
+    bool busy = false;
+    unsigned long long dropped = 0;
+
+    pthread_mutex_lock(&lock);
+    taken.clear();
+    for (Ring* ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t tail = ring->tail;
+        if (head - tail > RING_SIZE / 2) {
+            busy = true;
+        }
+        for (; tail != head; ++tail) {
+            taken.push_back(ring->records[tail % RING_SIZE]);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    unsigned long long newly_dropped = dropped - reported_drops;
+    reported_drops = dropped;
+    pthread_mutex_unlock(&lock);
+
+    if (newly_dropped > 0) {
+        Record record;
+        record.level = WARN;
+        record.length = std::sprintf(record.text, "log records dropped count=%llu total=%llu", newly_dropped, dropped);
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        record.time_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        taken.push_back(record);
+    }
+    for (size_t i = 0; i < taken.size(); ++i) {
+        int stream = (taken[i].level >= WARN) ? 1 : 0;
+        if (used[stream] + TEXT_SIZE + 64 > BATCH) {
+            writeAll(stream ? STDERR_FILENO : STDOUT_FILENO, out[stream], used[stream]);
+            used[stream] = 0;
+        }
+        used[stream] += format(taken[i], out[stream] + used[stream]);
+    }
+    for (int stream = 0; stream < 2; ++stream) {
+        if (used[stream] > 0) {
+            writeAll(stream ? STDERR_FILENO : STDOUT_FILENO, out[stream], used[stream]);
+        }
+    }
+    __atomic_add_fetch(&written, taken.size() - (newly_dropped > 0 ? 1 : 0), __ATOMIC_RELAXED);
+    return busy;
+}
+
+void* Logger::writerThread(void*) {
+    struct timespec interval;
+    interval.tv_sec = 0;
+    interval.tv_nsec = DRAIN_INTERVAL_MS * 1000000L;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (!drain()) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    drain();
+    return NULL;
+}
+
+Log::Log(Logger::Level level, const char* event) : level(level), active(false), time_ns(0), length(0) {
+    if (!Logger::enabled(level)) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    unsigned long suppressed;
+    if (!Logger::admit(event, ts.tv_sec, suppressed)) {
+        return;
+    }
+    active = true;
+    time_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    append(event, std::strlen(event));
+    if (suppressed > 0) {
+        field("suppressed", suppressed);
+    }
+}
+
+Log::~Log() {
+    if (active) {
+        Logger::submit(level, time_ns, text, length);
+    }
+}
+
+void Log::append(const char* data, size_t size) {
+    if (size > Logger::TEXT_SIZE - length) {
+        size = Logger::TEXT_SIZE - length;
+    }
+    std::memcpy(text + length, data, size);
+    length += size;
+}
+
+void Log::key(const char* name) {
+    append(" ", 1);
+    append(name, std::strlen(name));
+    append("=", 1);
+}
+
+// Values come from clients too, so anything that could break the line
+// into two or make it ambiguous is quoted or replaced.
+void Log::appendValue(const char* data, size_t size) {
+    bool quote = (size == 0);
+    for (size_t i = 0; i < size && !quote; ++i) {
+        quote = (data[i] == ' ' || data[i] == '"' || data[i] == '=');
+    }
+    if (quote) {
+        append("\"", 1);
+    }
+    for (size_t i = 0; i < size && length < Logger::TEXT_SIZE; ++i) {
+        char c = data[i];
+        if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+            c = '?';
+        } else if (c == '"' || c == '\\') {
+            append("\\", 1);
+        }
+        append(&c, 1);
+    }
+    if (quote) {
+        append("\"", 1);
+    }
+}
+
+Log& Log::field(const char* name, const std::string& value) {
+    if (active) {
+        key(name);
+        appendValue(value.data(), value.length());
+    }
+    return *this;
+}
+
+Log& Log::field(const char* name, const char* value) {
+    if (active) {
+        key(name);
+        appendValue(value, std::strlen(value));
+    }
+    return *this;
+}
+
+Log& Log::field(const char* name, int value) {
+    if (active) {
+        char digits[16];
+        key(name);
+        append(digits, std::sprintf(digits, "%d", value));
+    }
+    return *this;
+}
+
+Log& Log::field(const char* name, unsigned long value) {
+    if (active) {
+        char digits[24];
+        key(name);
+        append(digits, std::sprintf(digits, "%lu", value));
+    }
+    return *this;
+}
+
+Log& Log::field(const char* name, unsigned long long value) {
+    if (active) {
+        char digits[24];
+        key(name);
+        append(digits, std::sprintf(digits, "%llu", value));
+    }
+    return *this;
+}
@@ -0,0 +1,126 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <string>
+#include <cstddef>
+#include <ctime>
+#include <pthread.h>
+
+// Asynchronous logger. Each thread that logs gets its own single-producer
+// ring of fixed-size records, so the event loop only formats into a slot
+// and publishes it; a background thread drains every ring and does the
+// write(2). When a ring is full the record is dropped and counted rather
+// than blocking the loop on a slow stdout. The same event logged more than
+// RATE_LIMIT times in one second by one thread is suppressed, and the
+// count rides along on its next line. Until start() and after stop()
+// records are written synchronously instead.
+class Logger {
+public:
+    enum Level {
+        DEBUG,
+        INFO,
+        WARN,
+        ERROR
+    };
+
+    enum {
+        RING_SIZE = 1024,
+        TEXT_SIZE = 232,
+        RATE_LIMIT = 20,
+        RATE_SLOTS = 64,
+        DRAIN_INTERVAL_MS = 10
+    };
+
+    struct Stats {
+        unsigned long long written;
+        unsigned long long dropped;
+        unsigned long long suppressed;
+    };
+
+    struct Record {
+        unsigned long long time_ns;
+        int level;
+        unsigned int length;
+        char text[TEXT_SIZE];
+    };
+
+    struct RateSlot {
+        const char* event;
+        time_t window;
+        unsigned int count;
+        unsigned long suppressed;
+    };
+
+    // Written by its producer thread only, except tail, which belongs to
+    // the writer thread.
+    struct Ring {
+        Record records[RING_SIZE];
+        size_t head;
+        size_t tail;
+        unsigned long long dropped;
+        unsigned long long suppressed;
+        RateSlot slots[RATE_SLOTS];
+        Ring* next;
+    };
+
+private:
+    static Level threshold;
+    static bool running;
+    static bool stopping;
+    static pthread_t thread;
+    // Only ever taken by drain(), never around a write(2) or by a
+    // producer; the ring list and counters are read without it.
+    static pthread_mutex_t lock;
+    static Ring* rings;
+    static unsigned long long written;
+    static unsigned long long reported_drops;
+
+    static Ring* localRing();
+    static void* writerThread(void* arg);
+    static bool drain();
+    static size_t format(const Record& record, char* out);
+    static void writeAll(int fd, const char* data, size_t length);
+
+public:
+    static void start();
+    static void stop();
+    static bool setLevel(const std::string& name);
+    static bool enabled(Level level);
+    static Stats getStats();
+
+    static bool admit(const char* event, time_t now, unsigned long& suppressed);
+    static void submit(Level level, unsigned long long time_ns, const char* text, size_t length);
+};
+
+// One structured line: an event name and key=value fields, formatted in
+// place and handed to the logger when the temporary goes away, e.g.
+//   Log(Logger::INFO, "client connected").field("fd", fd).field("addr", ip);
+// A line below the threshold costs one comparison, a suppressed one a
+// clock read and a table probe.
+class Log {
+private:
+    Logger::Level level;
+    bool active;
+    unsigned long long time_ns;
+    size_t length;
+    char text[Logger::TEXT_SIZE];
+
+    Log(const Log&);
+    Log& operator=(const Log&);
+
+    void append(const char* data, size_t size);
+    void appendValue(const char* data, size_t size);
+    void key(const char* name);
+
+public:
+    Log(Logger::Level level, const char* event);
+    ~Log();
+
+    Log& field(const char* name, const std::string& value);
+    Log& field(const char* name, const char* value);
+    Log& field(const char* name, int value);
+    Log& field(const char* name, unsigned long value);
+    Log& field(const char* name, unsigned long long value);
+};
+
+#endif
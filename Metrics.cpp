@@ -0,0 +1,114 @@
+#include "Metrics.hpp"
+#include <sstream>
+
+void Metrics::counter(const char* name, const char* help, unsigned long long value) {
+    family(name, "counter", help);
+    sample("", value);
+}
+
+void Metrics::gauge(const char* name, const char* help, unsigned long long value) {
+    family(name, "gauge", help);
+    sample("", value);
+}
+
+void Metrics::family(const char* name, const char* type, const char* help) {
+    families.push_back(Family());
+    families.back().name = name;
+    families.back().type = type;
+    families.back().help = help;
+}
+
+// Adds a sample to the family opened last; labels are written without
+// braces, e.g. command="JOIN".
+void Metrics::sample(const std::string& labels, unsigned long long value) {
+    addSample(families.back().name, labels, value, false);
+}
+
+void Metrics::addSample(const std::string& name, const std::string& labels, unsigned long long value, bool bucket) {
+    Sample entry;
+    entry.name = name;
+    entry.labels = labels;
+    entry.value = value;
+    entry.bucket = bucket;
+    families.back().samples.push_back(entry);
+}
+
+// Buckets are cumulative, as Prometheus expects.
+void Metrics::histogram(const char* name, const char* help, const Histogram& histogram) {
+    family(name, "histogram", help);
+    std::string base(name);
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < Histogram::BUCKETS; ++i) {
+        cumulative += histogram.count(i);
+        std::ostringstream le;
+        le << "le=\"";
+        if (i == Histogram::BUCKETS - 1) {
+            le << "+Inf";
+        } else {
+            le << Histogram::upperBound(i);
+        }
+        le << '"';
+        addSample(base + "_bucket", le.str(), cumulative, true);
+    }
+    addSample(base + "_sum", "", histogram.getSum(), false);
+    addSample(base + "_count", "", cumulative, false);
+}
+
+void Metrics::summary(const char* name, const char* help, const LatencyHistogram& histogram) {
+    family(name, "summary", help);
+    quantiles("", histogram);
+}
+
+// Adds p50, p90, p99 and p99.9 with the sum and count to the summary
+// family opened last.
+void Metrics::quantiles(const std::string& labels, const LatencyHistogram& histogram) {
+    static const char* const names[] = { "0.5", "0.9", "0.99", "0.999" };
+    static const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    std::string base(families.back().name);
+    std::string prefix = labels.empty() ? labels : labels + ",";
+    for (size_t i = 0; i < sizeof(fractions) / sizeof(fractions[0]); ++i) {
+        addSample(base, prefix + "quantile=\"" + names[i] + "\"", histogram.percentile(fractions[i]), false);
+    }
+    addSample(base + "_sum", labels, histogram.getSum(), false);
+    addSample(base + "_count", labels, histogram.count(), false);
+}
+
+std::string Metrics::prometheus() const {
+    std::ostringstream out;
+    for (size_t f = 0; f < families.size(); ++f) {
+        const Family& entry = families[f];
+        out << "# HELP " << entry.name << ' ' << entry.help << '\n';
+        out << "# TYPE " << entry.name << ' ' << entry.type << '\n';
+        for (size_t s = 0; s < entry.samples.size(); ++s) {
+            const Sample& sample = entry.samples[s];
+            out << sample.name;
+            if (!sample.labels.empty()) {
+                out << '{' << sample.labels << '}';
+            }
+            out << ' ' << sample.value << '\n';
+        }
+    }
+    return out.str();
+}
+
+// Histogram buckets that add nothing to the one before are left out, so
+// a mostly empty distribution stays a few lines long.
+void Metrics::lines(std::vector<std::string>& out) const {
+    for (size_t f = 0; f < families.size(); ++f) {
+        const std::vector<Sample>& samples = families[f].samples;
+        for (size_t s = 0; s < samples.size(); ++s) {
+            const Sample& sample = samples[s];
+            if (sample.bucket && (sample.value == 0 || (s > 0 && samples[s - 1].value == sample.value))) {
+                continue;
+            }
+            std::ostringstream line;
+            line << sample.name;
+            if (!sample.labels.empty()) {
+                line << '{' << sample.labels << '}';
+            }
+            line << ' ' << sample.value;
+            out.push_back(line.str());
+        }
+    }
+}
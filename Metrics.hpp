@@ -0,0 +1,46 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <vector>
+#include "Histogram.hpp"
+#include "LatencyHistogram.hpp"
+
+// Snapshot of the server's counters and gauges, gathered once and then
+// rendered as Prometheus text for the HTTP endpoint or as plain
+// "name{labels} value" lines for STATS. Every metric is a family with a
+// type and help line followed by its samples.
+class Metrics {
+private:
+    struct Sample {
+        std::string name;
+        std::string labels;
+        unsigned long long value;
+        bool bucket;
+    };
+
+    struct Family {
+        const char* name;
+        const char* type;
+        const char* help;
+        std::vector<Sample> samples;
+    };
+
+    std::vector<Family> families;
+
+    void addSample(const std::string& name, const std::string& labels, unsigned long long value, bool bucket);
+
+public:
+    void counter(const char* name, const char* help, unsigned long long value);
+    void gauge(const char* name, const char* help, unsigned long long value);
+    void family(const char* name, const char* type, const char* help);
+    void sample(const std::string& labels, unsigned long long value);
+    void histogram(const char* name, const char* help, const Histogram& histogram);
+    void summary(const char* name, const char* help, const LatencyHistogram& histogram);
+    void quantiles(const std::string& labels, const LatencyHistogram& histogram);
+
+    std::string prometheus() const;
+    void lines(std::vector<std::string>& out) const;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "MetricsListener.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sstream>
+
+MetricsListener::MetricsListener(int port) : listen_fd(-1), poller(NULL) {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw std::runtime_error(std::string("Metrics socket creation failed: ") + strerror(errno));
+    }
+
+    int opt = 1;
+    struct sockaddr_in address;
+    std::fill(reinterpret_cast<char*>(&address), reinterpret_cast<char*>(&address) + sizeof(address), 0);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0
+        || fcntl(listen_fd, F_SETFL, O_NONBLOCK) < 0
+        || fcntl(listen_fd, F_SETFD, FD_CLOEXEC) < 0
+        || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0
+        || listen(listen_fd, MAX_CLIENTS) < 0) {
+        std::string error = strerror(errno);
+        close(listen_fd);
+        throw std::runtime_error("Metrics listener setup failed: " + error);
+    }
+}
+
+MetricsListener::~MetricsListener() {
+    for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        close(it->first);
+    }
+    if (listen_fd != -1) {
+        close(listen_fd);
+    }
+}
+
+void MetricsListener::attach(Poller* target) {
+    poller = target;
+    poller->add(listen_fd, Poller::READ, false);
+}
+
+bool MetricsListener::owns(int fd) const {
+    return fd == listen_fd || clients.find(fd) != clients.end();
+}
+
+int MetricsListener::getListenFd() const {
+    return listen_fd;
+}
+
+void MetricsListener::acceptClients() {
+    while (true) {
+#ifdef SOCK_NONBLOCK
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int fd = accept(listen_fd, NULL, NULL);
+#endif
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+#ifndef SOCK_NONBLOCK
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+            close(fd);
+            continue;
+        }
+#endif
+        if (clients.size() >= MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        clients[fd].sent = 0;
+        poller->add(fd, Poller::READ, false);
+    }
+}
+
+bool MetricsListener::isResponding(int fd) const {
+    std::map<int, Client>::const_iterator it = clients.find(fd);
+    return it != clients.end() && !it->second.response.empty();
+}
+
+// Returns true as soon as the request head is complete, with the request
+// path; anything after the head is never read. Clients that hang up or
+// fail before that, or send an oversized head, are closed.
+bool MetricsListener::readRequest(int fd, std::string& path) {
+    std::string& request = clients[fd].request;
+    char buffer[1024];
+    while (true) {
+        ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+        if (bytes > 0) {
+            request.append(buffer, bytes);
+            if (request.find("\r\n\r\n") != std::string::npos || request.find("\n\n") != std::string::npos) {
+                break;
+            }
+            if (request.size() > MAX_REQUEST) {
+                closeClient(fd);
+                return false;
+            }
+            continue;
+        }
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        closeClient(fd);
+        return false;
+    }
+
+    size_t start = request.find(' ');
+    size_t end = (start == std::string::npos) ? start : request.find(' ', start + 1);
+    path = (end == std::string::npos) ? std::string() : request.substr(start + 1, end - start - 1);
+    return true;
+}
+
+void MetricsListener::respond(int fd, const std::string& path, const std::string& body) {
+    std::ostringstream response;
+    if (path == "/metrics") {
+        response << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " << body.size()
+                 << "\r\nConnection: close\r\n\r\n" << body;
+    } else {
+        response << "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+
+    Client& client = clients[fd];
+    client.response = response.str();
+    client.sent = 0;
+    flush(fd);
+}
+
+// Sends what the socket takes; on EAGAIN the rest waits for WRITE
+// readiness, with READ dropped so a half-closed client does not spin the
+// loop. Done or failed, the connection is closed.
+void MetricsListener::flush(int fd) {
+    Client& client = clients[fd];
+    while (client.sent < client.response.size()) {
+        ssize_t bytes = send(fd, client.response.data() + client.sent, client.response.size() - client.sent,
+                             MSG_NOSIGNAL);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            poller->modify(fd, Poller::WRITE);
+            return;
+        }
+        if (bytes <= 0) {
+            break;
+        }
+        client.sent += bytes;
+    }
+    closeClient(fd);
+}
+
+void MetricsListener::closeClient(int fd) {
+    poller->remove(fd);
+    clients.erase(fd);
+    close(fd);
+}
@@ -0,0 +1,51 @@
+#ifndef METRICS_LISTENER_HPP
+#define METRICS_LISTENER_HPP
+
+#include <string>
+#include <map>
+#include "Poller.hpp"
+
+// Loopback HTTP port for Prometheus scrapes, served from the first
+// reactor's loop through plain readiness events on every backend. A
+// connection sends one request and is answered as soon as its head is
+// complete, whether or not the client has half-closed; whatever the
+// socket does not take at once is finished on WRITE readiness, and the
+// connection is closed when the response is out.
+class MetricsListener {
+public:
+    enum {
+        MAX_CLIENTS = 16,
+        MAX_REQUEST = 4096
+    };
+
+private:
+    struct Client {
+        std::string request;
+        std::string response;
+        size_t sent;
+    };
+
+    int listen_fd;
+    Poller* poller;
+    std::map<int, Client> clients;
+
+    MetricsListener(const MetricsListener& other);
+    MetricsListener& operator=(const MetricsListener& other);
+
+    void closeClient(int fd);
+
+public:
+    MetricsListener(int port);
+    ~MetricsListener();
+
+    void attach(Poller* poller);
+    bool owns(int fd) const;
+    int getListenFd() const;
+    void acceptClients();
+    bool isResponding(int fd) const;
+    bool readRequest(int fd, std::string& path);
+    void respond(int fd, const std::string& path, const std::string& body);
+    void flush(int fd);
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "OutputQueue.hpp"
+
+size_t OutputQueue::soft_limit = 256 * 1024;
+size_t OutputQueue::hard_limit = 1024 * 1024;
+size_t OutputQueue::memory_budget = 512 * 1024 * 1024;
+volatile size_t OutputQueue::total_bytes = 0;
+
+OutputQueue::OutputQueue() : head(0), count(0), offset(0), bytes(0) {
+}
+
+OutputQueue::~OutputQueue() {
+    clear();
+}
+
+void OutputQueue::setLimits(size_t soft, size_t hard, size_t budget) {
+    soft_limit = soft;
+    hard_limit = (hard > soft) ? hard : soft;
+    memory_budget = budget;
+}
+
+size_t OutputQueue::totalBytes() {
+    return total_bytes;
+}
+
+OutputQueue::Admission OutputQueue::admit(size_t length, Priority priority) const {
+    size_t used = total_bytes;
+    int shift = 0;
+    if (memory_budget > 0 && used >= memory_budget / 2) {
+        shift = (used >= memory_budget - memory_budget / 4) ? 2 : 1;
+    }
+
+    if (bytes + length > (hard_limit >> shift)) {
+        return OVERFLOW;
+    }
+    if (priority == LOW && bytes + length > (soft_limit >> shift)) {
+        return DROP;
+    }
+    return ADMIT;
+}
+
+void OutputQueue::grow() {
+    std::vector<SharedBuffer> larger(ring.empty() ? 8 : ring.size() * 2);
+    for (size_t i = 0; i < count; ++i) {
+        larger[i] = ring[(head + i) & (ring.size() - 1)];
+    }
+    ring.swap(larger);
+    head = 0;
+}
+
+void OutputQueue::push(const SharedBuffer& message) {
+    if (message.empty()) {
+        return;
+    }
+    if (count == ring.size()) {
+        grow();
+    }
+    ring[(head + count) & (ring.size() - 1)] = message;
+    ++count;
+    bytes += message.length();
+    __sync_fetch_and_add(&total_bytes, message.length());
+}
+
+int OutputQueue::gather(struct iovec* iov, int max) const {
+    int filled = 0;
+    for (size_t i = 0; i < count && filled < max; ++i, ++filled) {
+        const SharedBuffer& message = ring[(head + i) & (ring.size() - 1)];
+        size_t skip = (filled == 0) ? offset : 0;
+        iov[filled].iov_base = const_cast<char*>(message.data() + skip);
+        iov[filled].iov_len = message.length() - skip;
+    }
+    return filled;
+}
+
+// As gather(), also taking a reference to each message so the bytes stay
+// valid for a send that may outlive the queue.
+int OutputQueue::gather(struct iovec* iov, SharedBuffer* held, int max) const {
+    int filled = gather(iov, max);
+    for (int i = 0; i < filled; ++i) {
+        held[i] = ring[(head + i) & (ring.size() - 1)];
+    }
+    return filled;
+}
+
+void OutputQueue::consume(size_t amount) {
+    if (amount > bytes) {
+        amount = bytes;
+    }
+    bytes -= amount;
+    __sync_fetch_and_sub(&total_bytes, amount);
+
+    while (amount > 0) {
+        SharedBuffer& front = ring[head];
+        size_t left = front.length() - offset;
+        if (amount < left) {
+            offset += amount;
+            return;
+        }
+        amount -= left;
+        front = SharedBuffer();
+        head = (head + 1) & (ring.size() - 1);
+        --count;
+        offset = 0;
+    }
+}
+
+void OutputQueue::clear() {
+    __sync_fetch_and_sub(&total_bytes, bytes);
+    std::vector<SharedBuffer>().swap(ring);
+    head = 0;
+    count = 0;
+    offset = 0;
+    bytes = 0;
+}
+
+bool OutputQueue::empty() const {
+    return bytes == 0;
+}
+
+size_t OutputQueue::byteCount() const {
+    return bytes;
+}
+
+size_t OutputQueue::messageCount() const {
+    return count;
+}
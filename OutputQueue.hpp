@@ -0,0 +1,71 @@
+#ifndef OUTPUT_QUEUE_HPP
+#define OUTPUT_QUEUE_HPP
+
+#include <vector>
+#include "SharedBuffer.hpp"
+#include <cstddef>
+#include <sys/uio.h>
+
+// Per-connection queue of outgoing messages. Messages are shared buffers
+// handed to the kernel as an iovec array; sent bytes are consumed by
+// popping finished messages and advancing an offset into the first one,
+// so a partial write never copies the rest of the backlog. Entries live
+// in a power-of-two ring that keeps its slots once grown, so a queue in
+// steady state pushes and pops without touching the allocator.
+//
+// admit() applies the send-queue limits shared by every connection: past
+// the soft limit low-priority lines are dropped, past the hard limit the
+// client is a slow consumer to be disconnected. Both limits halve when
+// the bytes queued across all connections pass half of the memory
+// budget, and halve again past three quarters of it.
+class OutputQueue {
+public:
+    enum Priority {
+        NORMAL,
+        LOW
+    };
+
+    enum Admission {
+        ADMIT,
+        DROP,
+        OVERFLOW
+    };
+
+private:
+    static size_t soft_limit;
+    static size_t hard_limit;
+    static size_t memory_budget;
+    static volatile size_t total_bytes;
+
+    std::vector<SharedBuffer> ring;
+    size_t head;
+    size_t count;
+    size_t offset;
+    size_t bytes;
+
+    void grow();
+
+public:
+    enum {
+        MAX_IOV = 64
+    };
+
+    OutputQueue();
+    ~OutputQueue();
+
+    static void setLimits(size_t soft, size_t hard, size_t budget);
+    static size_t totalBytes();
+
+    Admission admit(size_t length, Priority priority) const;
+    void push(const SharedBuffer& message);
+    int gather(struct iovec* iov, int max) const;
+    int gather(struct iovec* iov, SharedBuffer* held, int max) const;
+    void consume(size_t count);
+    void clear();
+
+    bool empty() const;
+    size_t byteCount() const;
+    size_t messageCount() const;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "Poller.hpp"
+#include "UringPoller.hpp"
+#include "Logger.hpp"
+
+Poller::~Poller() {}
+
+void Poller::addListener(int fd) {
+    add(fd, READ, false);
+}
+
+void Poller::addConnection(int fd) {
+    add(fd, READ, true);
+}
+
+bool Poller::completesIo() const {
+    return false;
+}
+
+bool Poller::submitSend(int fd, const OutputQueue& queue) {
+    (void)fd;
+    (void)queue;
+    return false;
+}
+
+Poller* Poller::create(const std::string& backend) {
+#ifdef IRC_HAVE_IO_URING
+    if (backend == "uring") {
+        try {
+            return new UringPoller();
+        } catch (const std::exception& e) {
+            Log(Logger::WARN, "io_uring unavailable, falling back").field("error", e.what());
+        }
+    }
+#endif
+    if (backend == "select") {
+        return new SelectPoller();
+    }
+#ifdef IRC_USE_SELECT
+    return new SelectPoller();
+#else
+    return new EpollPoller();
+#endif
+}
+
+#ifndef IRC_USE_SELECT
+EpollPoller::EpollPoller() : epoll_fd(-1), ready(1024) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        throw std::runtime_error(std::string("Epoll creation failed: ") + strerror(errno));
+    }
+}
+
+EpollPoller::~EpollPoller() {
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+unsigned int EpollPoller::toEpoll(int fd, int events) const {
+    unsigned int mask = EPOLLRDHUP;
+    if (events & READ) mask |= EPOLLIN;
+    if (events & WRITE) mask |= EPOLLOUT;
+    if (fd < (int)edge.size() && edge[fd]) mask |= EPOLLET;
+    return mask;
+}
+
+void EpollPoller::add(int fd, int events, bool edgeTriggered) {
+    if (fd >= (int)edge.size()) {
+        edge.resize(fd + 1, 0);
+    }
+    edge[fd] = edgeTriggered;
+
+    struct epoll_event ev;
+    std::fill(reinterpret_cast<char*>(&ev), reinterpret_cast<char*>(&ev) + sizeof(ev), 0);
+    ev.events = toEpoll(fd, events);
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        throw std::runtime_error(std::string("Epoll add failed: ") + strerror(errno));
+    }
+}
+
+void EpollPoller::modify(int fd, int events) {
+    struct epoll_event ev;
+    std::fill(reinterpret_cast<char*>(&ev), reinterpret_cast<char*>(&ev) + sizeof(ev), 0);
+    ev.events = toEpoll(fd, events);
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        throw std::runtime_error(std::string("Epoll modify failed: ") + strerror(errno));
+    }
+}
+
+void EpollPoller::remove(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    if (fd < (int)edge.size()) {
+        edge[fd] = 0;
+    }
+}
+
+int EpollPoller::wait(std::vector<Event>& events, int timeout_ms) {
+    events.clear();
+
+    int count = epoll_wait(epoll_fd, &ready[0], ready.size(), timeout_ms);
+    if (count < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        Event event;
+        event.fd = ready[i].data.fd;
+        event.events = 0;
+        event.result = 0;
+        event.data = NULL;
+        if (ready[i].events & EPOLLIN) event.events |= READ;
+        if (ready[i].events & EPOLLOUT) event.events |= WRITE;
+        if (ready[i].events & (EPOLLHUP | EPOLLRDHUP)) event.events |= HANGUP;
+        if (ready[i].events & EPOLLERR) event.events |= ERROR;
+        events.push_back(event);
+    }
+
+    if (count == (int)ready.size()) {
+        ready.resize(ready.size() * 2);
+    }
+    return count;
+}
+
+const char* EpollPoller::getName() const {
+    return "epoll";
+}
+#endif
+
+SelectPoller::SelectPoller() : max_fd(-1) {
+    FD_ZERO(&read_set);
+    FD_ZERO(&write_set);
+}
+
+void SelectPoller::add(int fd, int events, bool edgeTriggered) {
+    (void)edgeTriggered;
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        throw std::runtime_error("Descriptor exceeds FD_SETSIZE");
+    }
+    if (fd > max_fd) {
+        max_fd = fd;
+    }
+    modify(fd, events);
+}
+
+void SelectPoller::modify(int fd, int events) {
+    if (events & READ) FD_SET(fd, &read_set); else FD_CLR(fd, &read_set);
+    if (events & WRITE) FD_SET(fd, &write_set); else FD_CLR(fd, &write_set);
+}
+
+void SelectPoller::remove(int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    FD_CLR(fd, &read_set);
+    FD_CLR(fd, &write_set);
+    while (max_fd >= 0 && !FD_ISSET(max_fd, &read_set) && !FD_ISSET(max_fd, &write_set)) {
+        max_fd--;
+    }
+}
+
+int SelectPoller::wait(std::vector<Event>& events, int timeout_ms) {
+    events.clear();
+
+    fd_set read_fds = read_set;
+    fd_set write_fds = write_set;
+    struct timeval tv;
+    struct timeval* tvp = NULL;
+    if (timeout_ms >= 0) {
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        tvp = &tv;
+    }
+
+    int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, tvp);
+    if (activity <= 0) {
+        return activity;
+    }
+
+    for (int fd = 0; fd <= max_fd; ++fd) {
+        Event event;
+        event.fd = fd;
+        event.events = 0;
+        event.result = 0;
+        event.data = NULL;
+        if (FD_ISSET(fd, &read_fds)) event.events |= READ;
+        if (FD_ISSET(fd, &write_fds)) event.events |= WRITE;
+        if (event.events) {
+            events.push_back(event);
+        }
+    }
+    return events.size();
+}
+
+const char* SelectPoller::getName() const {
+    return "select";
+}
@@ -0,0 +1,95 @@
+#ifndef POLLER_HPP
+#define POLLER_HPP
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include "OutputQueue.hpp"
+#ifndef IRC_USE_SELECT
+#include <sys/epoll.h>
+#endif
+
+class Poller {
+public:
+    enum {
+        READ = 1,
+        WRITE = 2,
+        HANGUP = 4,
+        ERROR = 8,
+        ACCEPT = 16,
+        DATA = 32,
+        SENT = 64
+    };
+
+    // ACCEPT, DATA and SENT are only produced by completion backends:
+    // result holds the accepted fd, the byte count (0 on EOF, -errno on
+    // error) or the send result, and data points at the received bytes,
+    // valid until the next wait().
+    struct Event {
+        int fd;
+        int events;
+        int result;
+        const char* data;
+    };
+
+    virtual ~Poller();
+
+    virtual void add(int fd, int events, bool edgeTriggered) = 0;
+    virtual void modify(int fd, int events) = 0;
+    virtual void remove(int fd) = 0;
+    virtual int wait(std::vector<Event>& events, int timeout_ms) = 0;
+    virtual const char* getName() const = 0;
+
+    virtual void addListener(int fd);
+    virtual void addConnection(int fd);
+    virtual bool completesIo() const;
+    virtual bool submitSend(int fd, const OutputQueue& queue);
+
+    static Poller* create(const std::string& backend = "");
+};
+
+#ifndef IRC_USE_SELECT
+class EpollPoller : public Poller {
+private:
+    int epoll_fd;
+    std::vector<struct epoll_event> ready;
+    std::vector<char> edge;
+
+    unsigned int toEpoll(int fd, int events) const;
+
+public:
+    EpollPoller();
+    ~EpollPoller();
+
+    void add(int fd, int events, bool edgeTriggered);
+    void modify(int fd, int events);
+    void remove(int fd);
+    int wait(std::vector<Event>& events, int timeout_ms);
+    const char* getName() const;
+};
+#endif
+
+// Fallback for builds without epoll (make POLLER=select); limited to FD_SETSIZE.
+class SelectPoller : public Poller {
+private:
+    fd_set read_set;
+    fd_set write_set;
+    int max_fd;
+
+public:
+    SelectPoller();
+
+    void add(int fd, int events, bool edgeTriggered);
+    void modify(int fd, int events);
+    void remove(int fd);
+    int wait(std::vector<Event>& events, int timeout_ms);
+    const char* getName() const;
+};
+
+#endif
@@ -0,0 +1,398 @@
+#include "Reactor.hpp"
+#include "User.hpp"
+#include "Logger.hpp"
+
+static __thread Reactor* current_reactor = NULL;
+
+Reactor::Reactor(int index, int listen_fd, int reactor_count, const std::string& backend, ConnectionTable& table) :
+    index(index),
+    listen_fd(listen_fd),
+    spare_fd(-1),
+    poller(NULL),
+    outboxes(reactor_count),
+    table(table),
+    connection_count(0),
+    tick(0),
+    stamp_ns(0),
+    timers(TimerWheel::now()),
+    now_ms(TimerWheel::now()) {
+    std::fill(reinterpret_cast<char*>(&accept_stats), reinterpret_cast<char*>(&accept_stats) + sizeof(accept_stats), 0);
+    std::fill(reinterpret_cast<char*>(&sendq_stats), reinterpret_cast<char*>(&sendq_stats) + sizeof(sendq_stats), 0);
+    std::fill(reinterpret_cast<char*>(&flood_stats), reinterpret_cast<char*>(&flood_stats) + sizeof(flood_stats), 0);
+    std::fill(reinterpret_cast<char*>(&io_stats), reinterpret_cast<char*>(&io_stats) + sizeof(io_stats), 0);
+    wake_pipe[0] = -1;
+    wake_pipe[1] = -1;
+    pthread_mutex_init(&inbox_lock, NULL);
+
+    try {
+        if (pipe(wake_pipe) < 0) {
+            throw std::runtime_error(std::string("Pipe creation failed: ") + strerror(errno));
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK) < 0 || fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC) < 0) {
+                throw std::runtime_error(std::string("Fcntl F_SETFL failed: ") + strerror(errno));
+            }
+        }
+
+        poller = Poller::create(backend);
+        if (listen_fd != -1) {
+            poller->addListener(listen_fd);
+            spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        poller->add(wake_pipe[0], Poller::READ, false);
+    } catch (const std::exception& e) {
+        delete poller;
+        for (int i = 0; i < 2; ++i) {
+            if (wake_pipe[i] != -1) {
+                close(wake_pipe[i]);
+            }
+        }
+        pthread_mutex_destroy(&inbox_lock);
+        throw;
+    }
+}
+
+Reactor::~Reactor() {
+    delete poller;
+    poller = NULL;
+
+    for (int i = 0; i < 2; ++i) {
+        if (wake_pipe[i] != -1) {
+            close(wake_pipe[i]);
+            wake_pipe[i] = -1;
+        }
+    }
+
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (spare_fd != -1) {
+        close(spare_fd);
+        spare_fd = -1;
+    }
+
+    pthread_mutex_destroy(&inbox_lock);
+}
+
+int Reactor::getIndex() const {
+    return index;
+}
+
+int Reactor::getListenFd() const {
+    return listen_fd;
+}
+
+int Reactor::getWakeFd() const {
+    return wake_pipe[0];
+}
+
+Poller* Reactor::getPoller() {
+    return poller;
+}
+
+pthread_t& Reactor::getThread() {
+    return thread;
+}
+
+std::vector<Poller::Event>& Reactor::getEvents() {
+    return events;
+}
+
+size_t Reactor::getConnectionCount() const {
+    return connection_count;
+}
+
+Reactor::AcceptStats& Reactor::getAcceptStats() {
+    return accept_stats;
+}
+
+Reactor::SendqStats& Reactor::getSendqStats() {
+    return sendq_stats;
+}
+
+Reactor::FloodStats& Reactor::getFloodStats() {
+    return flood_stats;
+}
+
+Reactor::IoStats& Reactor::getIoStats() {
+    return io_stats;
+}
+
+// Recipients per channel line, QUIT and NICK.
+Histogram& Reactor::getFanout() {
+    return fanout;
+}
+
+// Bytes a connection had queued at each write attempt.
+Histogram& Reactor::getSendqDepth() {
+    return sendq_depth;
+}
+
+// Busy time of each loop iteration, from the end of the wait to the end
+// of the flush.
+LatencyHistogram& Reactor::getLoopLatency() {
+    return loop_latency;
+}
+
+// Time from the recv that brought a line in to its command finishing.
+LatencyHistogram& Reactor::getInputLatency() {
+    return input_latency;
+}
+
+// Time from a line being queued on an idle connection to it being written.
+LatencyHistogram& Reactor::getOutputLatency() {
+    return output_latency;
+}
+
+// Nanosecond clock read at the start of each piece of work, so output
+// queued during it can be stamped without another clock read per line.
+unsigned long long Reactor::stampNs() {
+    stamp_ns = LatencyHistogram::now();
+    return stamp_ns;
+}
+
+unsigned long long Reactor::getStampNs() const {
+    return stamp_ns;
+}
+
+TimerWheel& Reactor::getTimers() {
+    return timers;
+}
+
+unsigned long long Reactor::getNow() const {
+    return now_ms;
+}
+
+unsigned long long Reactor::updateClock() {
+    now_ms = TimerWheel::now();
+    return now_ms;
+}
+
+unsigned long long Reactor::getTick() const {
+    return tick;
+}
+
+void Reactor::nextTick() {
+    ++tick;
+}
+
+void Reactor::addConnection(User* user) {
+    poller->addConnection(user->getFd());
+    connection_count++;
+}
+
+void Reactor::removeConnection(User* user) {
+    if (user->isClosing()) {
+        return;
+    }
+    user->setClosing(true);
+    timers.cancel(&user->getTimer());
+    timers.cancel(&user->getFloodTimer());
+    closing.push_back(user);
+    connection_count--;
+}
+
+void Reactor::reapClosed() {
+    for (size_t i = 0; i < closing.size(); ++i) {
+        poller->remove(closing[i]->getFd());
+        delete closing[i];
+    }
+    closing.clear();
+    overflowed.clear();
+}
+
+// Slow consumers are only recorded here; the server disconnects them once
+// the current fanout has finished walking member lists.
+void Reactor::markOverflow(int fd) {
+    overflowed.push_back(fd);
+}
+
+std::vector<int>& Reactor::getOverflowed() {
+    return overflowed;
+}
+
+User* Reactor::getConnection(int fd) {
+    User* user = table.get(fd);
+    return (user && user->getReactor() == this) ? user : NULL;
+}
+
+void Reactor::requestWrite(int fd) {
+    User* user = getConnection(fd);
+    if (!user || user->hasWriteInterest()) return;
+
+    if (poller->completesIo()) {
+        user->setWriteInterest(true);
+        pending_sends.push_back(fd);
+        return;
+    }
+    poller->modify(fd, (user->isReadPaused() ? 0 : Poller::READ) | Poller::WRITE);
+    user->setWriteInterest(true);
+}
+
+void Reactor::clearWrite(int fd) {
+    User* user = getConnection(fd);
+    if (!user || !user->hasWriteInterest()) return;
+
+    poller->modify(fd, user->isReadPaused() ? 0 : Poller::READ);
+    user->setWriteInterest(false);
+}
+
+void Reactor::rearmRead(int fd) {
+    User* user = getConnection(fd);
+    if (!user) return;
+
+    user->setReadPaused(false);
+    poller->modify(fd, Poller::READ | (user->hasWriteInterest() ? Poller::WRITE : 0));
+}
+
+// Stops read readiness for a throttled connection, so level-triggered
+// pollers do not spin on input that is being held in the kernel.
+void Reactor::pauseRead(int fd) {
+    User* user = getConnection(fd);
+    if (!user || user->isReadPaused()) return;
+
+    user->setReadPaused(true);
+    poller->modify(fd, user->hasWriteInterest() ? Poller::WRITE : 0);
+}
+
+// Round-robin list of connections with input left over after their turn.
+// Entries are dropped lazily: a connection that caught up in the meantime
+// has its flag cleared and is skipped when the list is served.
+void Reactor::markReady(User* user) {
+    if (user->isReadyQueued()) return;
+
+    user->setReadyQueued(true);
+    ready.push_back(user->getFd());
+}
+
+void Reactor::requeue(User* user) {
+    ready.push_back(user->getFd());
+}
+
+bool Reactor::hasReady() const {
+    return !ready.empty();
+}
+
+std::vector<int>& Reactor::takeReady() {
+    serving.clear();
+    serving.swap(ready);
+    return serving;
+}
+
+// Connections that queued output during this iteration. The server writes
+// them out once the iteration's input has been handled, so every reply a
+// command produced leaves in a single write.
+void Reactor::markDirty(int fd) {
+    User* user = getConnection(fd);
+    if (!user || user->isFlushQueued()) return;
+
+    user->setFlushQueued(true);
+    dirty.push_back(fd);
+}
+
+bool Reactor::hasDirty() const {
+    return !dirty.empty();
+}
+
+std::vector<int>& Reactor::takeDirty() {
+    flushing.clear();
+    flushing.swap(dirty);
+    return flushing;
+}
+
+void Reactor::flushSends() {
+    for (size_t i = 0; i < pending_sends.size(); ++i) {
+        User* user = getConnection(pending_sends[i]);
+        if (!user) {
+            continue;
+        }
+
+        if (!poller->submitSend(pending_sends[i], user->getSendQueue())) {
+            user->setWriteInterest(false);
+        }
+    }
+    pending_sends.clear();
+}
+
+// Out of descriptors, a pending connection keeps the listener readable
+// and the loop would spin on it. The spare descriptor is given up just
+// long enough to accept that connection and close it again. Returns
+// false when there is no spare to give up or nothing was accepted.
+bool Reactor::shedConnection() {
+    if (spare_fd == -1) {
+        spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (spare_fd == -1) {
+            return false;
+        }
+    }
+    close(spare_fd);
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd >= 0) {
+        close(fd);
+        accept_stats.shed++;
+    }
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
+}
+
+void Reactor::post(Reactor* target, const Delivery& delivery) {
+    outboxes[target->index].push_back(delivery);
+}
+
+void Reactor::flushOutboxes(const std::vector<Reactor*>& reactors) {
+    for (size_t i = 0; i < outboxes.size(); ++i) {
+        if (!outboxes[i].empty()) {
+            reactors[i]->receive(outboxes[i]);
+        }
+    }
+}
+
+void Reactor::receive(std::vector<Delivery>& batch) {
+    pthread_mutex_lock(&inbox_lock);
+    bool was_empty = inbox.empty();
+    if (was_empty) {
+        inbox.swap(batch);
+    } else {
+        inbox.insert(inbox.end(), batch.begin(), batch.end());
+    }
+    pthread_mutex_unlock(&inbox_lock);
+    batch.clear();
+
+    if (was_empty) {
+        wake();
+    }
+}
+
+void Reactor::drainInbox() {
+    char buffer[64];
+    while (read(wake_pipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+
+    std::vector<Delivery> batch;
+    pthread_mutex_lock(&inbox_lock);
+    batch.swap(inbox);
+    pthread_mutex_unlock(&inbox_lock);
+
+    for (std::vector<Delivery>::iterator it = batch.begin(); it != batch.end(); ++it) {
+        User* user = table.get(it->fd, it->generation);
+        if (user && user->getReactor() == this) {
+            user->queueOutput(it->line, it->priority);
+        }
+    }
+}
+
+void Reactor::wake() {
+    char byte = 1;
+    if (write(wake_pipe[1], &byte, 1) < 0 && errno != EAGAIN) {
+        Log(Logger::ERROR, "wake error").field("error", strerror(errno));
+    }
+}
+
+Reactor* Reactor::current() {
+    return current_reactor;
+}
+
+void Reactor::setCurrent(Reactor* reactor) {
+    current_reactor = reactor;
+}
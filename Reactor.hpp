@@ -0,0 +1,161 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Poller.hpp"
+#include "TimerWheel.hpp"
+#include "ConnectionTable.hpp"
+#include "OutputQueue.hpp"
+#include "Histogram.hpp"
+#include "LatencyHistogram.hpp"
+
+class User;
+
+// One event loop: a listening socket, a poller and the connections it
+// accepted. Only the owning reactor touches a connection's socket, input,
+// output queue, timers and flood bucket, inserts or removes its
+// ConnectionTable slot, or destroys it, so getConnection() reads its own
+// slots without the state lock. Other reactors hand it output through
+// post(). A user's nick, prefix, registration, channel list and fan-out
+// epoch are Server state: any reactor may write them under the exclusive
+// state lock and read them under either side. Closed connections are kept
+// until reapClosed() at the end of the loop iteration so pointers taken
+// earlier in the iteration stay valid.
+class Reactor {
+public:
+    struct Delivery {
+        int fd;
+        unsigned int generation;
+        SharedBuffer line;
+        OutputQueue::Priority priority;
+    };
+
+    struct AcceptStats {
+        unsigned long accepted;
+        unsigned long wakeups;
+        unsigned long full_batches;
+        unsigned long errors;
+        unsigned long shed;
+    };
+
+    struct SendqStats {
+        unsigned long dropped_lines;
+        unsigned long dropped_bytes;
+        unsigned long disconnects;
+    };
+
+    struct FloodStats {
+        unsigned long throttled_lines;
+        unsigned long disconnects;
+    };
+
+    struct IoStats {
+        unsigned long registrations;
+        unsigned long long lines_in;
+        unsigned long long lines_out;
+        unsigned long long bytes_in;
+        unsigned long long bytes_out;
+    };
+
+private:
+    int index;
+    int listen_fd;
+    int spare_fd;
+    int wake_pipe[2];
+    Poller* poller;
+    pthread_t thread;
+    pthread_mutex_t inbox_lock;
+    std::vector<Delivery> inbox;
+    std::vector<std::vector<Delivery> > outboxes;
+    ConnectionTable& table;
+    size_t connection_count;
+    std::vector<User*> closing;
+    std::vector<int> pending_sends;
+    std::vector<Poller::Event> events;
+    AcceptStats accept_stats;
+    SendqStats sendq_stats;
+    FloodStats flood_stats;
+    IoStats io_stats;
+    Histogram fanout;
+    Histogram sendq_depth;
+    LatencyHistogram loop_latency;
+    LatencyHistogram input_latency;
+    LatencyHistogram output_latency;
+    std::vector<int> overflowed;
+    std::vector<int> ready;
+    std::vector<int> serving;
+    std::vector<int> dirty;
+    std::vector<int> flushing;
+    unsigned long long tick;
+    unsigned long long stamp_ns;
+    TimerWheel timers;
+    unsigned long long now_ms;
+
+    Reactor(const Reactor& other);
+    Reactor& operator=(const Reactor& other);
+
+    void receive(std::vector<Delivery>& batch);
+
+public:
+    Reactor(int index, int listen_fd, int reactor_count, const std::string& backend, ConnectionTable& table);
+    ~Reactor();
+
+    int getIndex() const;
+    int getListenFd() const;
+    int getWakeFd() const;
+    Poller* getPoller();
+    pthread_t& getThread();
+    std::vector<Poller::Event>& getEvents();
+    size_t getConnectionCount() const;
+    AcceptStats& getAcceptStats();
+    SendqStats& getSendqStats();
+    FloodStats& getFloodStats();
+    IoStats& getIoStats();
+    Histogram& getFanout();
+    Histogram& getSendqDepth();
+    LatencyHistogram& getLoopLatency();
+    LatencyHistogram& getInputLatency();
+    LatencyHistogram& getOutputLatency();
+    unsigned long long stampNs();
+    unsigned long long getStampNs() const;
+    TimerWheel& getTimers();
+    unsigned long long getNow() const;
+    unsigned long long updateClock();
+    unsigned long long getTick() const;
+    void nextTick();
+
+    void addConnection(User* user);
+    void removeConnection(User* user);
+    void reapClosed();
+    void markOverflow(int fd);
+    std::vector<int>& getOverflowed();
+    User* getConnection(int fd);
+    void requestWrite(int fd);
+    void clearWrite(int fd);
+    void rearmRead(int fd);
+    void pauseRead(int fd);
+    void markReady(User* user);
+    void requeue(User* user);
+    bool hasReady() const;
+    std::vector<int>& takeReady();
+    void markDirty(int fd);
+    bool hasDirty() const;
+    std::vector<int>& takeDirty();
+    void flushSends();
+
+    void post(Reactor* target, const Delivery& delivery);
+    void flushOutboxes(const std::vector<Reactor*>& reactors);
+    void drainInbox();
+    void wake();
+    bool shedConnection();
+
+    static Reactor* current();
+    static void setCurrent(Reactor* reactor);
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "ReadBuffer.hpp"
+#include <cstring>
+
+ReadBuffer::ReadBuffer() : start(0), end(0), scanned(0), discarding(false) {
+}
+
+char* ReadBuffer::space() {
+    if (start > 0) {
+        std::memmove(data, data + start, end - start);
+        end -= start;
+        scanned -= start;
+        start = 0;
+    }
+    return data + end;
+}
+
+size_t ReadBuffer::available() const {
+    return CAPACITY - (end - start);
+}
+
+void ReadBuffer::commit(size_t count) {
+    end += count;
+}
+
+size_t ReadBuffer::append(const char* bytes, size_t count) {
+    char* tail = space();
+    if (count > available()) {
+        count = available();
+    }
+    std::memcpy(tail, bytes, count);
+    commit(count);
+    return count;
+}
+
+// Lines longer than MAX_LINE (terminator included) are dropped up to their
+// newline and reported once as TOO_LONG.
+ReadBuffer::Status ReadBuffer::nextLine(const char*& line, size_t& length) {
+    while (true) {
+        const char* newline = static_cast<const char*>(std::memchr(data + scanned, '\n', end - scanned));
+        if (!newline) {
+            scanned = end;
+            if (end - start < MAX_LINE) {
+                return PARTIAL;
+            }
+            start = end = scanned = 0;
+            if (discarding) {
+                return PARTIAL;
+            }
+            discarding = true;
+            return TOO_LONG;
+        }
+
+        size_t first = start;
+        length = newline - (data + first);
+        start = scanned = length + first + 1;
+
+        if (discarding) {
+            discarding = false;
+            continue;
+        }
+        if (length + 1 > MAX_LINE) {
+            return TOO_LONG;
+        }
+
+        if (length > 0 && data[first + length - 1] == '\r') {
+            length--;
+        }
+        line = data + first;
+        return LINE;
+    }
+}
+
+// Puts back the line nextLine() just returned, so it is returned again.
+void ReadBuffer::unread(const char* line) {
+    start = scanned = line - data;
+}
+
+void ReadBuffer::clear() {
+    start = end = scanned = 0;
+    discarding = false;
+}
+
+size_t ReadBuffer::size() const {
+    return end - start;
+}
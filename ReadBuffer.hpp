@@ -0,0 +1,44 @@
+#ifndef READ_BUFFER_HPP
+#define READ_BUFFER_HPP
+
+#include <cstddef>
+
+// Fixed-capacity per-connection input buffer. The socket is read straight
+// into the free tail, and complete lines are returned as pointers into the
+// buffer, so framing never allocates. Only the unfinished last line is
+// moved to the front before the next read.
+class ReadBuffer {
+public:
+    enum {
+        CAPACITY = 1024,
+        MAX_LINE = 512
+    };
+
+    enum Status {
+        LINE,
+        PARTIAL,
+        TOO_LONG
+    };
+
+private:
+    char data[CAPACITY];
+    size_t start;
+    size_t end;
+    size_t scanned;
+    bool discarding;
+
+public:
+    ReadBuffer();
+
+    char* space();
+    size_t available() const;
+    void commit(size_t count);
+    size_t append(const char* bytes, size_t count);
+
+    Status nextLine(const char*& line, size_t& length);
+    void unread(const char* line);
+    void clear();
+    size_t size() const;
+};
+
+#endif
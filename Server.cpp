@@ -1,322 +1,769 @@
 #include "Server.hpp"
 #include "CommandHandler.hpp"
+#include <iomanip>
+
+__thread int Server::StateGuard::held = 0;
+
+Server::StateGuard::StateGuard(Server& server, Mode mode) : lock(NULL) {
+    if (!server.threaded) {
+        return;
+    }
+    if (held) {
+        if (mode == EXCLUSIVE && held == SHARED) {
+            throw std::logic_error("exclusive state lock requested under a shared one");
+        }
+        return;
+    }
+
+    lock = &server.state_lock;
+    if (mode == SHARED) {
+        pthread_rwlock_rdlock(lock);
+    } else {
+        pthread_rwlock_wrlock(lock);
+    }
+    held = mode;
+}
+
+Server::StateGuard::~StateGuard() {
+    if (lock) {
+        held = 0;
+        pthread_rwlock_unlock(lock);
+    }
+}
+
+Server::Server(int port, const std::string& password, int threads, const std::string& backend, Listening listening) : server_fd(-1), port(port), password(password), users(tableCapacity()), threaded(threads > 1), shutdown_flag(NULL), accept_batch(64), registration_timeout(60000), ping_interval(120000), pong_timeout(60000), flood_rate(4), flood_burst(20), metrics(NULL), started(time(NULL)), report_requested(0) {
+    // Writers go first, or a steady stream of PRIVMSG would hold off every
+    // NICK and JOIN.
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&state_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    if (threads < 1) {
+        threads = 1;
+    }
 
-Server::Server(int port, const std::string& password) : server_fd(-1), port(port), password(password) {
     try {
-        setupServer();
+        for (int i = 0; i < threads; ++i) {
+            int listen_fd = (listening == NO_LISTENER) ? -1 : createListener(threads > 1);
+            try {
+                reactors.push_back(new Reactor(i, listen_fd, threads, backend, users));
+            } catch (const std::exception& e) {
+                if (listen_fd != -1) {
+                    close(listen_fd);
+                }
+                throw;
+            }
+        }
+        server_fd = reactors[0]->getListenFd();
+        for (int i = 0; i < threads; ++i) {
+            commands.push_back(new CommandHandler(*this));
+        }
     } catch (const std::exception& e) {
-        if (server_fd > 0) {
-            close(server_fd);
+        for (size_t i = 0; i < commands.size(); ++i) {
+            delete commands[i];
+        }
+        commands.clear();
+        for (size_t i = 0; i < reactors.size(); ++i) {
+            delete reactors[i];
         }
+        reactors.clear();
+        pthread_rwlock_destroy(&state_lock);
         throw;
     }
 }
 
 Server::~Server() {
-    std::map<int, User*>::iterator it;
-    for (it = users.begin(); it != users.end(); ++it) {
-        if (it->second) {
-            std::set<std::string> channels = it->second->getCurrentChannels();
-            std::set<std::string>::iterator ch_it;
-            for (ch_it = channels.begin(); ch_it != channels.end(); ++ch_it) {
-                Channel* channel = getChannel(*ch_it);
-                if (channel) {
-                    channel->removeUser(it->first);
-                }
-            }
-
-            close(it->first);
+    while (users.size() > 0) {
+        User* user = users.remove(users.getAll().back()->getFd());
+        const std::vector<Channel*>& joined = user->getCurrentChannels();
+        for (size_t i = 0; i < joined.size(); ++i) {
+            joined[i]->removeUser(user->getFd());
+        }
 
-            delete it->second;
+        if (user->getReactor()) {
+            user->getReactor()->removeConnection(user);
+        } else {
+            delete user;
         }
     }
-    users.clear();
 
+    std::vector<Channel*> all;
+    channels.values(all);
+    for (size_t i = 0; i < all.size(); ++i) {
+        delete all[i];
+    }
     channels.clear();
 
-    if (server_fd != -1) {
-        close(server_fd);
-        server_fd = -1;
+    delete metrics;
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        reactors[i]->reapClosed();
+        delete reactors[i];
+    }
+    for (size_t i = 0; i < commands.size(); ++i) {
+        delete commands[i];
+    }
+    commands.clear();
+    reactors.clear();
+    SharedBuffer::drainPool();
+    server_fd = -1;
+
+    pthread_rwlock_destroy(&state_lock);
+}
+
+size_t Server::tableCapacity() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return 65536;
     }
+    return std::min(static_cast<size_t>(limit.rlim_cur), static_cast<size_t>(1 << 20));
 }
 
-void Server::setupServer() {
+int Server::createListener(bool reusePort) {
     struct sockaddr_in server_addr;
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
         throw std::runtime_error(std::string("Socket creation failed: ") + strerror(errno));
     }
 
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        close(server_fd);
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        close(listen_fd);
         throw std::runtime_error(std::string("Setsockopt failed: ") + strerror(errno));
     }
 
+#ifdef SO_REUSEPORT
+    if (reusePort && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(listen_fd);
+        throw std::runtime_error(std::string("Setsockopt SO_REUSEPORT failed: ") + strerror(errno));
+    }
+#else
+    if (reusePort) {
+        close(listen_fd);
+        throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+    }
+#endif
+
     std::fill(reinterpret_cast<char*>(&server_addr), reinterpret_cast<char*>(&server_addr) + sizeof(server_addr), 0);
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(port);
 
-    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        close(server_fd);
+    if (bind(listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        close(listen_fd);
         throw std::runtime_error(std::string("Bind failed: ") + strerror(errno));
     }
 
-    if (listen(server_fd, SOMAXCONN) < 0) {
-        close(server_fd);
+    if (listen(listen_fd, SOMAXCONN) < 0) {
+        close(listen_fd);
         throw std::runtime_error(std::string("Listen failed: ") + strerror(errno));
     }
 
-    if (fcntl(server_fd, F_SETFL, O_NONBLOCK) < 0) {
-        close(server_fd);
+    if (fcntl(listen_fd, F_SETFL, O_NONBLOCK) < 0) {
+        close(listen_fd);
         throw std::runtime_error(std::string("Fcntl F_SETFL failed: ") + strerror(errno));
     }
+
+    return listen_fd;
 }
 
 void Server::run(volatile sig_atomic_t& shutdown_requested) {
-    fd_set read_fds, write_fds;
-    struct timeval tv;
-    int max_fd = server_fd;
+    Log(Logger::INFO, "server running").field("port", port).field("io", reactors[0]->getPoller()->getName())
+        .field("reactors", static_cast<unsigned long>(reactors.size()));
+
+    shutdown_flag = &shutdown_requested;
+    contexts.resize(reactors.size());
+
+    size_t started = 1;
+    if (reactors.size() > 1) {
+        sigset_t blocked, previous;
+        sigemptyset(&blocked);
+        sigaddset(&blocked, SIGINT);
+        sigaddset(&blocked, SIGTERM);
+        sigaddset(&blocked, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+
+        for (; started < reactors.size(); ++started) {
+            contexts[started].server = this;
+            contexts[started].reactor = reactors[started];
+            int err = pthread_create(&reactors[started]->getThread(), NULL, reactorThread, &contexts[started]);
+            if (err != 0) {
+                Log(Logger::ERROR, "thread creation failed").field("error", strerror(err));
+                break;
+            }
+        }
 
-    std::cout << "Server is running on port " << port << "..." << std::endl;
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    }
 
-    while (!shutdown_requested) {
-        FD_ZERO(&read_fds);
-        FD_ZERO(&write_fds);
-        FD_SET(server_fd, &read_fds);
+    runReactor(*reactors[0]);
 
-        std::map<int, User*>::iterator it;
-        for (it = users.begin(); it != users.end(); ++it) {
-            FD_SET(it->first, &read_fds);
+    for (size_t i = 1; i < started; ++i) {
+        reactors[i]->wake();
+        pthread_join(reactors[i]->getThread(), NULL);
+    }
 
-            if (!it->second->getWriteBuffer().empty()) {
-                FD_SET(it->first, &write_fds);
-            }
-            if (it->first > max_fd) {
-                max_fd = it->first;
-            }
-        }
+    Reactor::AcceptStats stats = getAcceptStats();
+    Log(Logger::INFO, "accept summary").field("accepted", stats.accepted).field("wakeups", stats.wakeups)
+        .field("full_batches", stats.full_batches).field("batch", accept_batch).field("errors", stats.errors).field("shed", stats.shed);
 
-        if (shutdown_requested) {
-            std::cout << "Shutdown requested. Cleaning up all connections..." << std::endl;
-            for (it = users.begin(); it != users.end(); ++it) {
-                disconnectUser(it->first);
-            }
-            break;
-        }
+    Reactor::SendqStats sendq = getSendqStats();
+    Log(Logger::INFO, "sendq summary").field("dropped_lines", sendq.dropped_lines)
+        .field("dropped_bytes", sendq.dropped_bytes).field("slow_consumers", sendq.disconnects);
+
+    Reactor::FloodStats flood = getFloodStats();
+    Log(Logger::INFO, "flood summary").field("throttled_lines", flood.throttled_lines)
+        .field("excess_flood", flood.disconnects);
+}
 
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
+void* Server::reactorThread(void* arg) {
+    ThreadContext* context = static_cast<ThreadContext*>(arg);
+    context->server->runReactor(*context->reactor);
+    SharedBuffer::drainPool();
+    return NULL;
+}
 
-        int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+void Server::runReactor(Reactor& reactor) {
+    Reactor::setCurrent(&reactor);
+    Poller* poller = reactor.getPoller();
+    std::vector<Poller::Event>& events = reactor.getEvents();
+
+    while (!*shutdown_flag) {
+        int timeout = reactor.hasReady() ? 0 : reactor.getTimers().nextTimeout(reactor.updateClock());
+        int activity = poller->wait(events, timeout);
+        unsigned long long started = reactor.stampNs();
+        reactor.updateClock();
+        reactor.nextTick();
+        if (report_requested && reactor.getIndex() == 0) {
+            report_requested = 0;
+            printLatencyReport();
+        }
         if (activity < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            std::cerr << "Select error: " << strerror(errno) << std::endl;
+            Log(Logger::ERROR, "poll error").field("error", strerror(errno));
             continue;
         }
 
-        if (FD_ISSET(server_fd, &read_fds)) {
-            handleNewConnection();
-        }
-
-        std::vector<int> fds_to_check;
-        std::vector<int> fds_to_remove;
-
-        std::map<int, User*> users_copy = users;
+        for (size_t i = 0; i < events.size(); ++i) {
+            int fd = events[i].fd;
+            if (events[i].events & Poller::ACCEPT) {
+                acceptConnection(reactor, events[i].result);
+                continue;
+            }
+            if (events[i].events & Poller::DATA) {
+                handleClientInput(reactor, fd, events[i].data, events[i].result);
+                continue;
+            }
+            if (events[i].events & Poller::SENT) {
+                handleSendCompletion(reactor, fd, events[i].result);
+                continue;
+            }
+            if (fd == reactor.getListenFd()) {
+                handleNewConnection(reactor);
+                continue;
+            }
+            if (fd == reactor.getWakeFd()) {
+                reactor.stampNs();
+                reactor.drainInbox();
+                continue;
+            }
+            if (metrics && reactor.getIndex() == 0 && metrics->owns(fd)) {
+                serveMetrics(fd);
+                continue;
+            }
 
-        for (std::map<int, User*>::iterator it = users_copy.begin(); it != users_copy.end(); ++it) {
-            if (FD_ISSET(it->first, &read_fds)) {
-                fds_to_check.push_back(it->first);
+            if (events[i].events & (Poller::READ | Poller::HANGUP | Poller::ERROR)) {
+                handleClientData(reactor, fd);
+            }
+            if ((events[i].events & Poller::WRITE) && reactor.getConnection(fd)) {
+                handleWrite(reactor, fd);
             }
         }
 
-        for (std::vector<int>::iterator it = fds_to_check.begin(); it != fds_to_check.end(); ++it) {
-            handleClientData(*it);
+        reactor.stampNs();
+        Timer* timer;
+        while ((timer = reactor.getTimers().expire(reactor.getNow())) != NULL) {
+            User* user = static_cast<User*>(timer->data);
+            if (timer == &user->getFloodTimer()) {
+                resumeInput(reactor, user);
+            } else {
+                handleTimer(reactor, user);
+            }
         }
 
+        serveReadyList(reactor);
+        disconnectSlowConsumers(reactor);
+        flushOutput(reactor);
+        reactor.flushOutboxes(reactors);
+        reactor.flushSends();
+        reactor.reapClosed();
+        reactor.getLoopLatency().record(LatencyHistogram::now() - started);
+    }
 
-        for (std::map<int, User*>::iterator it = users_copy.begin(); it != users_copy.end(); ++it) {
-            if (FD_ISSET(it->first, &write_fds)) {
-                handleWrite(it->first);
+    if (reactor.getIndex() == 0) {
+        Log(Logger::INFO, "shutdown requested");
+        for (size_t i = 1; i < reactors.size(); ++i) {
+            reactors[i]->wake();
+        }
+    }
+    {
+        StateGuard guard(*this, StateGuard::EXCLUSIVE);
+        std::vector<int> owned;
+        const std::vector<User*>& all = users.getAll();
+        for (size_t i = 0; i < all.size(); ++i) {
+            if (all[i]->getReactor() == &reactor) {
+                owned.push_back(all[i]->getFd());
             }
         }
+        for (size_t i = 0; i < owned.size(); ++i) {
+            disconnectUser(owned[i]);
+        }
+    }
+    reactor.flushOutboxes(reactors);
+    reactor.reapClosed();
+    Reactor::setCurrent(NULL);
+}
 
-        static int check_counter = 0;
-        if (++check_counter >= 3) {
-            check_counter = 0;
-            for (std::map<int, User*>::iterator it = users_copy.begin(); it != users_copy.end(); ++it) {
-                if (!FD_ISSET(it->first, &read_fds)) {
-                    if (checkClientConnection(it->first) == false) {
-                        fds_to_remove.push_back(it->first);
-                    }
+void Server::handleNewConnection(Reactor& reactor) {
+    Reactor::AcceptStats& stats = reactor.getAcceptStats();
+    stats.wakeups++;
+
+    int accepted = 0;
+    while (accepted < accept_batch) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+#ifdef SOCK_NONBLOCK
+        int client_fd = accept4(reactor.getListenFd(), (struct sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int client_fd = accept(reactor.getListenFd(), (struct sockaddr*)&client_addr, &client_len);
+#endif
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                stats.errors++;
+                Log(Logger::ERROR, "accept error").field("error", strerror(errno));
+                if (reactor.shedConnection()) {
+                    continue;
                 }
+                return;
             }
-
-            for (std::vector<int>::iterator it = fds_to_remove.begin(); it != fds_to_remove.end(); ++it) {
-                std::cout << "Detected disconnected client: " << *it << std::endl;
-                disconnectUser(*it);
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                stats.errors++;
+                Log(Logger::ERROR, "accept error").field("error", strerror(errno));
             }
+            return;
+        }
+
+#ifndef SOCK_NONBLOCK
+        if (fcntl(client_fd, F_SETFL, O_NONBLOCK) < 0) {
+            Log(Logger::ERROR, "fcntl error").field("fd", client_fd).field("error", strerror(errno));
+            close(client_fd);
+            continue;
         }
+#endif
+
+        accepted++;
+        registerConnection(reactor, client_fd, client_addr);
     }
-}
 
-void Server::handleNewConnection() {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+    stats.full_batches++;
+}
 
-    int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
+// The completion backend reports a failed multishot accept here too, so
+// running out of descriptors sheds the pending connection the same way.
+void Server::acceptConnection(Reactor& reactor, int client_fd) {
     if (client_fd < 0) {
-        std::cerr << "Accept error: " << strerror(errno) << std::endl;
+        reactor.getAcceptStats().errors++;
+        Log(Logger::ERROR, "accept error").field("error", strerror(-client_fd));
+        reactor.shedConnection();
         return;
     }
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
 
-    if (fcntl(client_fd, F_SETFL, O_NONBLOCK) < 0) {
-        std::cerr << "Fcntl error for client " << client_fd << ": " << strerror(errno) << std::endl;
-        close(client_fd);
-        return;
-    }
+    std::fill(reinterpret_cast<char*>(&client_addr), reinterpret_cast<char*>(&client_addr) + sizeof(client_addr), 0);
+    getpeername(client_fd, (struct sockaddr*)&client_addr, &client_len);
+    registerConnection(reactor, client_fd, client_addr);
+}
 
+void Server::registerConnection(Reactor& reactor, int client_fd, const struct sockaddr_in& client_addr) {
     char client_ip[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
-    std::cout << "New client connected: " << client_fd << " from " << client_ip << std::endl;
+    Log(Logger::INFO, "client connected").field("fd", client_fd).field("addr", client_ip);
+
+    reactor.getAcceptStats().accepted++;
 
+    User* newUser = NULL;
     try {
-        User* newUser = new User(client_fd);
+        newUser = new User(client_fd, &reactor);
         newUser->setAuthenticated(false);
-        users.insert(std::pair<int, User*>(client_fd, newUser));
+        newUser->setLastActivity(reactor.getNow());
     } catch (const std::exception& e) {
-        std::cerr << "Error creating user for client " << client_fd << ": " << e.what() << std::endl;
+        Log(Logger::ERROR, "user creation failed").field("fd", client_fd).field("error", e.what());
         close(client_fd);
+        return;
+    }
+
+    StateGuard guard(*this, StateGuard::EXCLUSIVE);
+    if (!users.insert(newUser)) {
+        Log(Logger::WARN, "connection table full").field("fd", client_fd);
+        delete newUser;
+        return;
+    }
+
+    try {
+        reactor.addConnection(newUser);
+    } catch (const std::exception& e) {
+        Log(Logger::ERROR, "registration failed").field("fd", client_fd).field("error", e.what());
+        users.remove(client_fd);
+        delete newUser;
+        return;
     }
+    reactor.getTimers().schedule(&newUser->getTimer(), reactor.getNow() + registration_timeout, newUser);
 }
 
-void Server::handleClientData(int client_fd) {
-    User* user = getUser(client_fd);
-    if (!user) {
-        if (client_fd > 0) {
-            close(client_fd);
-        }
+// Serves one connection for at most LINE_BUDGET lines and READ_BUDGET
+// bytes per loop iteration. Whatever is left goes on the reactor's ready
+// list and is picked up next iteration, after everyone else had a turn.
+void Server::handleClientData(Reactor& reactor, int client_fd) {
+    User* user = reactor.getConnection(client_fd);
+    if (!user || user->isThrottled()) {
         return;
     }
+    if (user->getServedTick() == reactor.getTick()) {
+        reactor.markReady(user);
+        return;
+    }
+    user->setServedTick(reactor.getTick());
+    reactor.stampNs();
 
-    char buffer[1024];
-    std::fill(buffer, buffer + sizeof(buffer), 0);
+    ReadBuffer& input = user->getReadBuffer();
+    size_t lines = LINE_BUDGET;
+    size_t budget = READ_BUDGET;
+    bool closed = false;
 
-    int bytes_read = recv(client_fd, buffer, sizeof(buffer) - 1, MSG_NOSIGNAL);
+    if (!processInput(user, false, lines)) {
+        reactor.markReady(user);
+        return;
+    }
+    if (user->isClosing() || user->isThrottled()) {
+        return;
+    }
+
+    while (true) {
+        int bytes_read = recv(client_fd, input.space(), input.available(), MSG_NOSIGNAL);
+
+        if (bytes_read > 0) {
+            input.commit(bytes_read);
+            user->setInputSince(reactor.stampNs());
+            reactor.getIoStats().bytes_in += bytes_read;
+            user->setLastActivity(reactor.getNow());
+            bool done = processInput(user, false, lines);
+            if (user->isClosing() || user->isThrottled()) {
+                return;
+            }
+            if (!done || static_cast<size_t>(bytes_read) >= budget) {
+                reactor.markReady(user);
+                return;
+            }
+            budget -= bytes_read;
+            continue;
+        }
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
 
-    if (bytes_read <= 0) {
         if (bytes_read == 0) {
-            std::cout << "Client gracefully disconnected: " << client_fd << std::endl;
+            Log(Logger::INFO, "client disconnected").field("fd", client_fd);
         } else {
-            std::cerr << "Error reading from client " << client_fd << ": " << strerror(errno) << std::endl;
+            Log(Logger::WARN, "read error").field("fd", client_fd).field("error", strerror(errno));
         }
-        disconnectUser(client_fd);
-        return;
+        closed = true;
+        break;
     }
 
-    buffer[bytes_read] = '\0';
-    std::string received_data(buffer);
-
-    user->appendToReadBuffer(received_data);
+    user->setReadyQueued(false);
+    if (closed) {
+        processInput(user, true, lines);
+    }
+}
 
-    std::string& readBuffer = user->getReadBuffer();
-    size_t pos = 0;
-    size_t newline_pos;
+void Server::handleClientInput(Reactor& reactor, int client_fd, const char* data, int length) {
+    User* user = reactor.getConnection(client_fd);
+    if (!user) {
+        return;
+    }
 
-    while ((newline_pos = readBuffer.find('\n', pos)) != std::string::npos) {
-        size_t line_start = pos;
-        if (line_start > 0 && readBuffer[line_start - 1] == '\r') {
-            line_start--;
+    size_t lines = LINE_BUDGET;
+    if (length <= 0) {
+        if (length == 0) {
+            Log(Logger::INFO, "client disconnected").field("fd", client_fd);
+        } else {
+            Log(Logger::WARN, "read error").field("fd", client_fd).field("error", strerror(-length));
         }
+        processInput(user, true, lines);
+        return;
+    }
 
-        std::string command_line = readBuffer.substr(line_start, newline_pos - line_start);
+    reactor.getIoStats().bytes_in += length;
+    user->setLastActivity(reactor.getNow());
+    std::string& backlog = user->getInputBacklog();
+    if (user->isThrottled() || user->isReadyQueued() || !backlog.empty()
+        || user->getServedTick() == reactor.getTick()) {
+        user->appendBacklog(data, length, reactor.stampNs());
+        if (backlog.size() >= INPUT_BACKLOG) {
+            reactor.pauseRead(client_fd);
+        }
+        if (!user->isThrottled()) {
+            reactor.markReady(user);
+        }
+        return;
+    }
+    user->setServedTick(reactor.getTick());
+    user->setInputSince(reactor.stampNs());
+
+    ReadBuffer& input = user->getReadBuffer();
+    while (length > 0) {
+        size_t copied = input.append(data, length);
+        data += copied;
+        length -= copied;
+        bool done = processInput(user, false, lines);
+        if (user->isClosing()) {
+            return;
+        }
+        if (user->isThrottled() || !done) {
+            user->appendBacklog(data, length, user->getInputSince());
+            if (!done) {
+                reactor.markReady(user);
+            }
+            return;
+        }
+    }
+}
 
-        if (!command_line.empty() && command_line[command_line.length() - 1] == '\r') {
-            command_line = command_line.substr(0, command_line.length() - 1);
+// Runs complete lines until the input runs out, the flood bucket empties
+// or lines reaches zero. Returns false only in the last case, when lines
+// are still waiting. Input that ends in EOF is run to the end regardless.
+bool Server::processInput(User* user, bool closed, size_t& lines) {
+    int client_fd = user->getFd();
+    Reactor* reactor = user->getReactor();
+
+    ReadBuffer& input = user->getReadBuffer();
+    TokenBucket& bucket = user->getFloodBucket();
+    const char* line;
+    size_t length;
+    ReadBuffer::Status status;
+
+    while ((status = input.nextLine(line, length)) != ReadBuffer::PARTIAL) {
+        if (status == ReadBuffer::TOO_LONG) {
+            const std::string& nick = user->getNickname();
+            user->sendMessage(":server 417 " + (nick.empty() ? std::string("*") : nick) + " :Input line was too long");
+            continue;
         }
 
-        if (!command_line.empty()) {
+        if (length > 0) {
+            if (reactor && !closed) {
+                if (lines == 0) {
+                    input.unread(line);
+                    return false;
+                }
+                if (!bucket.ready(reactor->getNow(), flood_rate, flood_burst)) {
+                    input.unread(line);
+                    throttleInput(*reactor, user);
+                    return true;
+                }
+                if (bucket.full(flood_burst)) {
+                    user->setThrottledSince(0);
+                }
+            }
+            if (reactor) {
+                reactor->getIoStats().lines_in++;
+            }
             try {
-                CommandHandler handler(*this);
-                handler.parseMessage(user, command_line);
+                bucket.charge(commands[reactor ? reactor->getIndex() : 0]->parseMessage(user, line, length));
             } catch (const std::exception& e) {
-                std::cerr << "Error processing message: " << e.what() << std::endl;
+                Log(Logger::ERROR, "command failed").field("fd", client_fd).field("error", e.what());
+            }
+            if (reactor && user->getInputSince() != 0) {
+                reactor->getInputLatency().record(reactor->stampNs() - user->getInputSince());
+            }
+            if (lines > 0) {
+                lines--;
+            }
+            if (user->isClosing()) {
+                return true;
             }
         }
+    }
+
+    if (closed) {
+        disconnectUser(client_fd);
+    }
+    return true;
+}
+
+// Leaves the rest of the input where it is until the bucket has refilled:
+// in the read buffer and the kernel for readiness pollers, in the input
+// backlog and then the kernel for completion-based ones. Throttling
+// counts as continuous until the client lets its bucket fill up again.
+void Server::throttleInput(Reactor& reactor, User* user) {
+    unsigned long long now = reactor.getNow();
+    if (user->getThrottledSince() == 0) {
+        user->setThrottledSince(now);
+    } else if (now - user->getThrottledSince() >= FLOOD_GRACE) {
+        reactor.getFloodStats().disconnects++;
+        closeWithError(user->getFd(), "Excess Flood");
+        return;
+    }
+
+    reactor.getFloodStats().throttled_lines++;
+    reactor.pauseRead(user->getFd());
+    reactor.getTimers().schedule(&user->getFloodTimer(), user->getFloodBucket().readyAt(flood_rate), user);
+}
+
+void Server::resumeInput(Reactor& reactor, User* user) {
+    if (!reactor.getPoller()->completesIo()) {
+        reactor.rearmRead(user->getFd());
+    }
+    serveReady(reactor, user);
+}
 
-        pos = newline_pos + 1;
+// Next turn for a connection that had input left over.
+void Server::serveReady(Reactor& reactor, User* user) {
+    if (!reactor.getPoller()->completesIo()) {
+        handleClientData(reactor, user->getFd());
+        return;
+    }
+
+    user->setServedTick(reactor.getTick());
+    reactor.stampNs();
+    size_t lines = LINE_BUDGET;
+    bool done = processInput(user, false, lines);
+    if (user->isClosing() || user->isThrottled()) {
+        return;
     }
-    if (pos < readBuffer.length()) {
-        readBuffer = readBuffer.substr(pos);
+    if (done) {
+        done = feedBacklog(user, lines);
+    }
+    if (user->isClosing() || user->isThrottled()) {
+        return;
+    }
+    if (user->isReadPaused() && user->getInputBacklog().size() < INPUT_BACKLOG) {
+        reactor.rearmRead(user->getFd());
+    }
+    if (done) {
+        user->setReadyQueued(false);
     } else {
-        user->clearReadBuffer();
+        reactor.markReady(user);
+    }
+}
+
+bool Server::feedBacklog(User* user, size_t& lines) {
+    std::string& backlog = user->getInputBacklog();
+    ReadBuffer& input = user->getReadBuffer();
+    size_t offset = 0;
+    bool done = true;
+    while (offset < backlog.size()) {
+        user->setInputSince(user->getBacklogStamp(offset));
+        offset += input.append(backlog.data() + offset, backlog.size() - offset);
+        done = processInput(user, false, lines);
+        if (user->isClosing()) {
+            return true;
+        }
+        if (user->isThrottled() || !done) {
+            break;
+        }
     }
+    user->consumeBacklog(offset);
+    return done;
 }
 
 void Server::addUser(int fd) {
-    users.insert(std::pair<int, User*>(fd, new User(fd)));
+    StateGuard guard(*this, StateGuard::EXCLUSIVE);
+    User* user = new User(fd);
+    if (!users.insert(user)) {
+        delete user;
+    }
 }
 
 void Server::removeUser(int fd) {
-    std::map<int, User*>::iterator it = users.find(fd);
-    if (it != users.end()) {
-        if (it->second) {
-            it->second->clearReadBuffer();
-
-            std::set<std::string> channels = it->second->getCurrentChannels();
-            std::set<std::string>::iterator ch_it;
-            for (ch_it = channels.begin(); ch_it != channels.end(); ++ch_it) {
-                Channel* channel = getChannel(*ch_it);
-                if (channel) {
-                    channel->removeUser(fd);
-                }
-            }
+    StateGuard guard(*this, StateGuard::EXCLUSIVE);
+    User* user = users.remove(fd);
+    if (!user) {
+        return;
+    }
 
-            for (ch_it = channels.begin(); ch_it != channels.end(); ++ch_it) {
-                Channel* channel = getChannel(*ch_it);
-                if (channel && channel->getUserCount() == 0) {
-                    removeChannel(*ch_it);
-                }
-            }
+    user->clearReadBuffer();
+    if (!user->getNickname().empty() && getUserByNick(user->getNickname()) == user) {
+        nicks.erase(user->getNickname());
+    }
 
-            delete it->second;
+    const std::vector<Channel*>& joined = user->getCurrentChannels();
+    for (size_t i = 0; i < joined.size(); ++i) {
+        joined[i]->removeUser(fd);
+        if (joined[i]->getUserCount() == 0) {
+            removeChannel(joined[i]);
         }
+    }
 
-        users.erase(it);
-
-        if (fd > 0) {
-            close(fd);
-        }
+    if (user->getReactor()) {
+        user->getReactor()->removeConnection(user);
+    } else {
+        delete user;
     }
 }
 
 User* Server::getUser(int fd) {
-    std::map<int, User*>::iterator it = users.find(fd);
-    return (it != users.end()) ? it->second : NULL;
+    return users.get(fd);
 }
 
-Channel* Server::getChannel(const std::string& name) {
-    std::map<std::string, Channel>::iterator it = channels.find(name);
-    return (it != channels.end()) ? &(it->second) : NULL;
+User* Server::getUserByNick(const std::string& nick) {
+    User** user = nicks.find(nick);
+    return user ? *user : NULL;
 }
 
-const Channel* Server::getChannel(const std::string& name) const {
-    std::map<std::string, Channel>::const_iterator it = channels.find(name);
-    return (it != channels.end()) ? &(it->second) : NULL;
+bool Server::setNickname(User* user, const std::string& nick) {
+    StateGuard guard(*this, StateGuard::EXCLUSIVE);
+    User* owner = getUserByNick(nick);
+    if (owner && owner != user) {
+        return false;
+    }
+
+    if (!user->getNickname().empty()) {
+        nicks.erase(user->getNickname());
+    }
+    nicks.insert(nick, user);
+    user->setNickname(nick);
+    return true;
 }
 
-void Server::createChannel(const std::string& name) {
-    if (channels.find(name) == channels.end()) {
-        channels.insert(std::pair<std::string, Channel>(name, Channel(name)));
+Channel* Server::getChannel(const std::string& name) {
+    Channel** channel = channels.find(name);
+    return channel ? *channel : NULL;
+}
+
+Channel* Server::createChannel(const std::string& name) {
+    Channel* channel = getChannel(name);
+    if (!channel) {
+        channel = new Channel(name);
+        channels.insert(name, channel);
     }
+    return channel;
 }
 
-void Server::removeChannel(const std::string& name) {
-    channels.erase(name);
+void Server::removeChannel(Channel* channel) {
+    channels.erase(channel->getName());
+    delete channel;
 }
 
 void Server::broadcast(const std::string& channel_name, const std::string& message) {
@@ -326,51 +773,216 @@ void Server::broadcast(const std::string& channel_name, const std::string& messa
     }
 }
 
-void Server::handleWrite(int fd) {
-    User* user = getUser(fd);
+void Server::handleWrite(Reactor& reactor, int fd) {
+    User* user = reactor.getConnection(fd);
     if (!user) return;
 
-    std::string& writeBuffer = user->getWriteBuffer();
-    if (writeBuffer.empty()) return;
+    writeQueue(reactor, user);
+}
+
+// Sends as much of the queue as the socket takes. Poller write interest is
+// only armed once the socket buffer is full; a queue that needs several
+// gather writes is corked so the boundaries between them do not turn into
+// short segments. A completion backend is never written to directly: the
+// queue is handed to the reactor, and its send goes into the ring with
+// every other one at the next wait(), gathered from the queue's own
+// buffers like the sendmsg() below.
+void Server::writeQueue(Reactor& reactor, User* user) {
+    int fd = user->getFd();
+    OutputQueue& queue = user->getSendQueue();
+    reactor.getSendqDepth().record(queue.byteCount());
+    if (reactor.getPoller()->completesIo()) {
+        if (!queue.empty()) {
+            reactor.requestWrite(fd);
+        }
+        return;
+    }
+    unsigned long long since = user->getQueuedSince();
+    bool written = false;
+    bool corked = queue.messageCount() > OutputQueue::MAX_IOV && setCork(fd, true);
+
+    while (!queue.empty()) {
+        struct iovec iov[OutputQueue::MAX_IOV];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = queue.gather(iov, OutputQueue::MAX_IOV);
+
+        ssize_t bytes_sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
 
-    int bytes_sent = send(fd, writeBuffer.c_str(), writeBuffer.length(), MSG_NOSIGNAL);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            Log(Logger::WARN, "write error").field("fd", fd).field("error", strerror(errno));
+            disconnectUser(fd);
+            return;
+        }
 
-    if (bytes_sent < 0) {
-        std::cerr << "Error writing to client " << fd << ": " << strerror(errno) << std::endl;
+        queue.consume(bytes_sent);
+        reactor.getIoStats().bytes_out += bytes_sent;
+        written = true;
+    }
+
+    if (corked) {
+        setCork(fd, false);
+    }
+    if (written) {
+        reactor.getOutputLatency().record(reactor.stampNs() - since);
+    }
+    if (queue.empty()) {
+        reactor.clearWrite(fd);
+    } else {
+        reactor.requestWrite(fd);
+    }
+}
+
+// Writes out every connection that queued output during this iteration,
+// straight from the loop instead of waiting for the poller to report the
+// socket writable. Connections already waiting on writability are left to
+// the poller.
+void Server::flushOutput(Reactor& reactor) {
+    while (reactor.hasDirty()) {
+        std::vector<int>& dirty = reactor.takeDirty();
+        for (size_t i = 0; i < dirty.size(); ++i) {
+            User* user = reactor.getConnection(dirty[i]);
+            if (!user || !user->isFlushQueued()) {
+                continue;
+            }
+            user->setFlushQueued(false);
+            if (!user->hasWriteInterest()) {
+                writeQueue(reactor, user);
+            }
+        }
+    }
+}
+
+bool Server::setCork(int fd, bool on) {
+#ifdef TCP_CORK
+    int value = on ? 1 : 0;
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0;
+#else
+    (void)fd;
+    (void)on;
+    return false;
+#endif
+}
+
+void Server::handleSendCompletion(Reactor& reactor, int fd, int result) {
+    User* user = reactor.getConnection(fd);
+    if (!user) return;
+
+    if (result < 0 && result != -EAGAIN && result != -EINTR) {
+        Log(Logger::WARN, "write error").field("fd", fd).field("error", strerror(-result));
         disconnectUser(fd);
         return;
     }
 
-    if (bytes_sent > 0) {
-        writeBuffer = writeBuffer.substr(bytes_sent);
+    OutputQueue& queue = user->getSendQueue();
+    if (result > 0) {
+        queue.consume(result);
+        reactor.getIoStats().bytes_out += result;
+        reactor.getOutputLatency().record(reactor.stampNs() - user->getQueuedSince());
+    }
+
+    user->setWriteInterest(false);
+    if (!queue.empty()) {
+        reactor.markDirty(fd);
     }
 }
 
-bool Server::checkClientConnection(int client_fd) {
-    int error = 0;
-    socklen_t len = sizeof(error);
-    int result = getsockopt(client_fd, SOL_SOCKET, SO_ERROR, &error, &len);
+void Server::handleTimer(Reactor& reactor, User* user) {
+    unsigned long long now = reactor.getNow();
+    TimerWheel& timers = reactor.getTimers();
 
-    if (result < 0) {
-        return false;
-    }
+    switch (user->getKeepalive()) {
+        case User::KEEPALIVE_REGISTRATION:
+            if (!user->isRegistered()) {
+                closeWithError(user->getFd(), "Registration timeout");
+                return;
+            }
+            user->setKeepalive(User::KEEPALIVE_PING);
+            timers.schedule(&user->getTimer(), user->getLastActivity() + ping_interval, user);
+            break;
 
-    if (error != 0) {
-        return false;
+        case User::KEEPALIVE_PING:
+            if (now - user->getLastActivity() < ping_interval) {
+                timers.schedule(&user->getTimer(), user->getLastActivity() + ping_interval, user);
+                return;
+            }
+            user->sendMessage("PING :localhost");
+            user->setPingSent(now);
+            user->setKeepalive(User::KEEPALIVE_PONG);
+            timers.schedule(&user->getTimer(), now + pong_timeout, user);
+            break;
+
+        case User::KEEPALIVE_PONG:
+            if (user->getLastActivity() < user->getPingSent()) {
+                closeWithError(user->getFd(), "Ping timeout");
+                return;
+            }
+            user->setKeepalive(User::KEEPALIVE_PING);
+            timers.schedule(&user->getTimer(), user->getLastActivity() + ping_interval, user);
+            break;
     }
+}
 
-    char buffer[1];
-    result = recv(client_fd, buffer, 1, MSG_PEEK | MSG_NOSIGNAL);
+// The ERROR line goes out after whatever is still queued, in one
+// non-blocking gather write, so it never lands inside a partly sent line.
+// A connection already waiting on its socket, or with a completion send
+// in flight, is closed without it.
+void Server::closeWithError(int fd, const std::string& reason) {
+    Log(Logger::INFO, "closing client").field("fd", fd).field("reason", reason);
+
+    User* user = getUser(fd);
+    if (user && !user->hasWriteInterest()) {
+        std::string line = "ERROR :Closing Link: (" + reason + ")\r\n";
+        struct iovec iov[OutputQueue::MAX_IOV];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = user->getSendQueue().gather(iov, OutputQueue::MAX_IOV - 1);
+        iov[msg.msg_iovlen].iov_base = const_cast<char*>(line.data());
+        iov[msg.msg_iovlen].iov_len = line.length();
+        msg.msg_iovlen++;
+        sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    disconnectUser(fd);
+}
 
-    if (result < 0) {
-        if (errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN) {
-            return false;
+void Server::serveReadyList(Reactor& reactor) {
+    std::vector<int>& ready = reactor.takeReady();
+    for (size_t i = 0; i < ready.size(); ++i) {
+        User* user = reactor.getConnection(ready[i]);
+        if (!user || !user->isReadyQueued()) {
+            continue;
         }
-    } else if (result == 0) {
-        return false;
+        if (user->isThrottled()) {
+            user->setReadyQueued(false);
+            continue;
+        }
+        if (user->getServedTick() == reactor.getTick()) {
+            reactor.requeue(user);
+            continue;
+        }
+        user->setReadyQueued(false);
+        serveReady(reactor, user);
     }
+}
 
-    return true;
+void Server::disconnectSlowConsumers(Reactor& reactor) {
+    std::vector<int>& overflowed = reactor.getOverflowed();
+    for (size_t i = 0; i < overflowed.size(); ++i) {
+        User* user = reactor.getConnection(overflowed[i]);
+        if (user && !user->isClosing()) {
+            reactor.getSendqStats().disconnects++;
+            closeWithError(overflowed[i], "SendQ exceeded");
+        }
+    }
+    overflowed.clear();
 }
 
 void Server::disconnectUser(int fd) {
@@ -381,6 +993,227 @@ void Server::disconnectUser(int fd) {
     removeUser(fd);
 }
 
+void Server::setAcceptBatch(int batch) {
+    accept_batch = (batch > 0) ? batch : 1;
+}
+
+void Server::setTimeouts(int registration, int ping, int pong) {
+    registration_timeout = static_cast<unsigned long long>(registration) * 1000;
+    ping_interval = static_cast<unsigned long long>(ping) * 1000;
+    pong_timeout = static_cast<unsigned long long>(pong) * 1000;
+}
+
+void Server::setFloodLimits(int rate, int burst) {
+    flood_rate = (rate > 0) ? rate : 1;
+    flood_burst = (burst > 0) ? burst : 1;
+}
+
+void Server::setOperPassword(const std::string& value) {
+    oper_password = value;
+}
+
+// Serves Prometheus text on a loopback port from the first reactor.
+void Server::setMetricsPort(int metrics_port) {
+    delete metrics;
+    metrics = NULL;
+    metrics = new MetricsListener(metrics_port);
+    metrics->attach(reactors[0]->getPoller());
+}
+
+void Server::serveMetrics(int fd) {
+    if (fd == metrics->getListenFd()) {
+        metrics->acceptClients();
+        return;
+    }
+
+    if (metrics->isResponding(fd)) {
+        metrics->flush(fd);
+        return;
+    }
+    std::string path;
+    if (metrics->readRequest(fd, path)) {
+        std::string body;
+        if (path == "/metrics") {
+            Metrics snapshot;
+            collectMetrics(snapshot);
+            body = snapshot.prometheus();
+        }
+        metrics->respond(fd, path, body);
+    }
+}
+
+void Server::setSendqLimits(size_t soft, size_t hard, size_t budget) {
+    OutputQueue::setLimits(soft, hard, budget);
+}
+
+Reactor::AcceptStats Server::getAcceptStats() const {
+    Reactor::AcceptStats total;
+    std::fill(reinterpret_cast<char*>(&total), reinterpret_cast<char*>(&total) + sizeof(total), 0);
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        const Reactor::AcceptStats& stats = reactors[i]->getAcceptStats();
+        total.accepted += stats.accepted;
+        total.wakeups += stats.wakeups;
+        total.full_batches += stats.full_batches;
+        total.errors += stats.errors;
+        total.shed += stats.shed;
+    }
+    return total;
+}
+
+Reactor::FloodStats Server::getFloodStats() const {
+    Reactor::FloodStats total;
+    std::fill(reinterpret_cast<char*>(&total), reinterpret_cast<char*>(&total) + sizeof(total), 0);
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        const Reactor::FloodStats& stats = reactors[i]->getFloodStats();
+        total.throttled_lines += stats.throttled_lines;
+        total.disconnects += stats.disconnects;
+    }
+    return total;
+}
+
+Reactor::SendqStats Server::getSendqStats() const {
+    Reactor::SendqStats total;
+    std::fill(reinterpret_cast<char*>(&total), reinterpret_cast<char*>(&total) + sizeof(total), 0);
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        const Reactor::SendqStats& stats = reactors[i]->getSendqStats();
+        total.dropped_lines += stats.dropped_lines;
+        total.dropped_bytes += stats.dropped_bytes;
+        total.disconnects += stats.disconnects;
+    }
+    return total;
+}
+
+// Reactor and command counters are read while their owners keep updating
+// them, like the shutdown summary does; the connection table and channel
+// registry are read under the shared state lock.
+void Server::collectMetrics(Metrics& out) {
+    Reactor::AcceptStats accept = getAcceptStats();
+    Reactor::SendqStats sendq = getSendqStats();
+    Reactor::FloodStats flood = getFloodStats();
+    Reactor::IoStats io;
+    std::fill(reinterpret_cast<char*>(&io), reinterpret_cast<char*>(&io) + sizeof(io), 0);
+    Histogram fanout;
+    Histogram depth;
+    LatencyHistogram loop;
+    LatencyHistogram input;
+    LatencyHistogram output;
+    unsigned long long connections = 0;
+    unsigned long long iterations = 0;
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        const Reactor::IoStats& stats = reactors[i]->getIoStats();
+        io.registrations += stats.registrations;
+        io.lines_in += stats.lines_in;
+        io.lines_out += stats.lines_out;
+        io.bytes_in += stats.bytes_in;
+        io.bytes_out += stats.bytes_out;
+        fanout.merge(reactors[i]->getFanout());
+        depth.merge(reactors[i]->getSendqDepth());
+        loop.merge(reactors[i]->getLoopLatency());
+        input.merge(reactors[i]->getInputLatency());
+        output.merge(reactors[i]->getOutputLatency());
+        connections += reactors[i]->getConnectionCount();
+        iterations += reactors[i]->getTick();
+    }
+
+    out.gauge("ircserv_connections", "Open client connections.", connections);
+    out.counter("ircserv_connections_accepted_total", "Client connections accepted.", accept.accepted);
+    out.counter("ircserv_accept_errors_total", "Failed accept calls.", accept.errors);
+    out.counter("ircserv_connections_shed_total", "Connections closed unserved because descriptors ran out.", accept.shed);
+    out.counter("ircserv_registrations_total", "Clients that completed registration.", io.registrations);
+    out.counter("ircserv_lines_in_total", "Lines received from clients.", io.lines_in);
+    out.counter("ircserv_lines_out_total", "Lines queued to clients.", io.lines_out);
+    out.counter("ircserv_bytes_in_total", "Bytes received from clients.", io.bytes_in);
+    out.counter("ircserv_bytes_out_total", "Bytes written to clients.", io.bytes_out);
+    out.counter("ircserv_loop_iterations_total", "Event loop iterations across reactors.", iterations);
+    out.gauge("ircserv_sendq_bytes", "Bytes waiting in send queues.", OutputQueue::totalBytes());
+    out.counter("ircserv_sendq_dropped_lines_total", "Low-priority lines dropped past the soft send-queue limit.",
+                sendq.dropped_lines);
+    out.counter("ircserv_sendq_disconnects_total", "Clients disconnected past the hard send-queue limit.",
+                sendq.disconnects);
+    out.counter("ircserv_flood_throttled_lines_total", "Lines held back by flood control.", flood.throttled_lines);
+    out.counter("ircserv_flood_disconnects_total", "Clients disconnected for excess flood.", flood.disconnects);
+    Logger::Stats log = Logger::getStats();
+    out.counter("ircserv_log_written_total", "Log records written.", log.written);
+    out.counter("ircserv_log_dropped_total", "Log records dropped because a ring was full.", log.dropped);
+    out.counter("ircserv_log_suppressed_total", "Log records suppressed by the repeat rate limit.", log.suppressed);
+    out.histogram("ircserv_broadcast_fanout", "Recipients per channel broadcast, QUIT or NICK.", fanout);
+    out.histogram("ircserv_sendq_depth_bytes", "Bytes queued for a client at each write attempt.", depth);
+    out.summary("ircserv_loop_iteration_nanoseconds", "Busy time of each event loop iteration.", loop);
+    out.summary("ircserv_input_latency_nanoseconds", "Time from recv to the line's command finishing.", input);
+    out.summary("ircserv_output_latency_nanoseconds", "Time from queueing on an idle connection to the write.", output);
+
+    {
+        StateGuard guard(*this, StateGuard::SHARED);
+        out.gauge("ircserv_users", "Connections known to the server.", users.size());
+        out.gauge("ircserv_channels", "Channels in the registry.", channels.size());
+    }
+
+    std::vector<CommandHandler::Command> totals;
+    CommandHandler::totalCommands(commands, totals);
+    const CommandHandler::Command* table = &totals[0];
+    size_t count = totals.size();
+    out.family("ircserv_command_lines_in_total", "counter", "Lines received per command.");
+    for (size_t i = 0; i < count; ++i) {
+        out.sample(std::string("command=\"") + table[i].name + "\"", table[i].linesIn);
+    }
+    out.family("ircserv_command_lines_out_total", "counter", "Lines sent in reply to each command.");
+    for (size_t i = 0; i < count; ++i) {
+        out.sample(std::string("command=\"") + table[i].name + "\"", table[i].linesOut);
+    }
+    out.family("ircserv_command_cpu_microseconds_total", "counter", "Thread CPU time spent in each command handler, estimated from sampled calls.");
+    for (size_t i = 0; i < count; ++i) {
+        out.sample(std::string("command=\"") + table[i].name + "\"", table[i].cpuNs / 1000);
+    }
+    out.family("ircserv_command_nanoseconds", "summary", "Wall time of each command handler call.");
+    for (size_t i = 0; i < count; ++i) {
+        if (table[i].latency.count() > 0) {
+            out.quantiles(std::string("command=\"") + table[i].name + "\"", table[i].latency);
+        }
+    }
+}
+
+// Only sets a flag, so it is safe to call from a signal handler; the first
+// reactor prints the report at the top of its next iteration.
+void Server::requestReport() {
+    report_requested = 1;
+}
+
+static void printPercentiles(const char* name, const LatencyHistogram& histogram) {
+    std::cout << "  " << std::left << std::setw(10) << name << std::right
+              << " n=" << histogram.count() << std::fixed << std::setprecision(1)
+              << "  p50 " << histogram.percentile(0.5) / 1000.0
+              << "  p90 " << histogram.percentile(0.9) / 1000.0
+              << "  p99 " << histogram.percentile(0.99) / 1000.0
+              << "  p99.9 " << histogram.percentile(0.999) / 1000.0
+              << "  max " << histogram.getMax() / 1000.0 << " us" << std::endl;
+}
+
+void Server::printLatencyReport() {
+    LatencyHistogram loop;
+    LatencyHistogram input;
+    LatencyHistogram output;
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        loop.merge(reactors[i]->getLoopLatency());
+        input.merge(reactors[i]->getInputLatency());
+        output.merge(reactors[i]->getOutputLatency());
+    }
+
+    std::cout << "Latency report:" << std::endl;
+    printPercentiles("loop", loop);
+    printPercentiles("input", input);
+    printPercentiles("output", output);
+
+    std::vector<CommandHandler::Command> totals;
+    CommandHandler::totalCommands(commands, totals);
+    const CommandHandler::Command* table = &totals[0];
+    size_t count = totals.size();
+    for (size_t i = 0; i < count; ++i) {
+        if (table[i].latency.count() > 0) {
+            printPercentiles(table[i].name, table[i].latency);
+        }
+    }
+}
+
 int Server::getServerFd() const {
     return server_fd;
 }
@@ -389,11 +1222,23 @@ const std::string& Server::getPassword() const {
     return password;
 }
 
-const std::map<int, User*>& Server::getUsers() const {
-    return users;
+const std::string& Server::getOperPassword() const {
+    return oper_password;
+}
+
+size_t Server::getUptime() const {
+    return static_cast<size_t>(time(NULL) - started);
+}
+
+const std::vector<User*>& Server::getUsers() const {
+    return users.getAll();
+}
+
+const std::vector<CommandHandler*>& Server::getCommandHandlers() const {
+    return commands;
 }
 
-const std::map<std::string, Channel>& Server::getChannels() const {
-    return channels;
+size_t Server::getChannelCount() const {
+    return channels.size();
 }
 
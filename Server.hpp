@@ -5,6 +5,13 @@
 #include <map>
 #include "User.hpp"
 #include "Channel.hpp"
+#include "Poller.hpp"
+#include "Reactor.hpp"
+#include "ConnectionTable.hpp"
+#include "CasemapTable.hpp"
+#include "Metrics.hpp"
+#include "MetricsListener.hpp"
+#include "Logger.hpp"
 #include <signal.h>
 #include <iostream>
 #include <cstdlib>
@@ -13,48 +20,160 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <algorithm>
 #include <errno.h>
-#include <sys/select.h>
+#include <stdexcept>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <ctime>
 
+class CommandHandler;
 
 class Server {
+public:
+    // Holds the state lock for a scope. Guards nest on one thread: an
+    // inner guard is free, except that EXCLUSIVE cannot be taken inside
+    // SHARED. Nothing is locked with a single reactor.
+    class StateGuard {
+    public:
+        enum Mode {
+            SHARED = 1,
+            EXCLUSIVE = 2
+        };
+
+        StateGuard(Server& server, Mode mode);
+        ~StateGuard();
+
+    private:
+        static __thread int held;
+        pthread_rwlock_t* lock;
+
+        StateGuard(const StateGuard& other);
+        StateGuard& operator=(const StateGuard& other);
+    };
+
 private:
+    struct ThreadContext {
+        Server* server;
+        Reactor* reactor;
+    };
+
+    // Bytes read and lines run for one connection per loop iteration before
+    // the reactor moves on to the others. Completion-based input waiting
+    // for its turn pauses the connection's recv at INPUT_BACKLOG bytes. A
+    // client may stay throttled for FLOOD_GRACE ms before it is an Excess
+    // Flood.
+    enum {
+        READ_BUDGET = 16384,
+        LINE_BUDGET = 32,
+        FLOOD_GRACE = 30000,
+        INPUT_BACKLOG = 16384
+    };
+
     int server_fd;
     int port;
     std::string password;
-    std::map<int, User*> users;
-    std::map<std::string, Channel> channels;
+    ConnectionTable users;
+    CasemapTable<User*> nicks;
+    CasemapTable<Channel*> channels;
+    std::vector<Reactor*> reactors;
+    std::vector<CommandHandler*> commands;
+    std::vector<ThreadContext> contexts;
+    // Nicks, channels, the connection table and each user's nick, prefix,
+    // registration and channel list are written only under the exclusive
+    // side of this lock. Commands that just read them and send, PRIVMSG
+    // among them, run under the shared side on every reactor at once; a
+    // line for another reactor's user goes through that reactor's inbox.
+    // Each reactor has its own CommandHandler, so parsing and per-command
+    // counters need no lock.
+    bool threaded;
+    pthread_rwlock_t state_lock;
+    volatile sig_atomic_t* shutdown_flag;
+    int accept_batch;
+    unsigned long long registration_timeout;
+    unsigned long long ping_interval;
+    unsigned long long pong_timeout;
+    int flood_rate;
+    int flood_burst;
+    std::string oper_password;
+    MetricsListener* metrics;
+    time_t started;
+    volatile sig_atomic_t report_requested;
 
-    void setupServer();
-    void handleNewConnection();
-    void handleClientData(int client_fd);
-    bool checkClientConnection(int client_fd);
+    static size_t tableCapacity();
+    int createListener(bool reusePort);
+    void runReactor(Reactor& reactor);
+    static void* reactorThread(void* arg);
+    void handleNewConnection(Reactor& reactor);
+    void acceptConnection(Reactor& reactor, int client_fd);
+    void registerConnection(Reactor& reactor, int client_fd, const struct sockaddr_in& client_addr);
+    void handleClientData(Reactor& reactor, int client_fd);
+    void handleClientInput(Reactor& reactor, int client_fd, const char* data, int length);
+    bool processInput(User* user, bool closed, size_t& lines);
+    void throttleInput(Reactor& reactor, User* user);
+    void resumeInput(Reactor& reactor, User* user);
+    void serveReady(Reactor& reactor, User* user);
+    void serveReadyList(Reactor& reactor);
+    bool feedBacklog(User* user, size_t& lines);
+    void handleTimer(Reactor& reactor, User* user);
+    void closeWithError(int fd, const std::string& reason);
+    void disconnectSlowConsumers(Reactor& reactor);
+    void flushOutput(Reactor& reactor);
+    void serveMetrics(int fd);
+    void printLatencyReport();
+    void writeQueue(Reactor& reactor, User* user);
+    static bool setCork(int fd, bool on);
 
 public:
-    Server(int port, const std::string& password);
+    // NO_LISTENER builds every reactor without a listening socket, for
+    // benches that drive the handlers directly.
+    enum Listening {
+        LISTEN,
+        NO_LISTENER
+    };
+
+    Server(int port, const std::string& password, int threads = 1, const std::string& backend = "",
+           Listening listening = LISTEN);
     ~Server();
 
     void run(volatile sig_atomic_t& shutdown_requested);
     void disconnectUser(int fd);
-    void handleWrite(int fd);
+    void handleWrite(Reactor& reactor, int fd);
+    void handleSendCompletion(Reactor& reactor, int fd, int result);
     void broadcast(const std::string& channel_name, const std::string& message);
 
+    void setAcceptBatch(int batch);
+    void setTimeouts(int registration, int ping, int pong);
+    void setSendqLimits(size_t soft, size_t hard, size_t budget);
+    void setFloodLimits(int rate, int burst);
+    void setOperPassword(const std::string& value);
+    void setMetricsPort(int port);
+    Reactor::AcceptStats getAcceptStats() const;
+    Reactor::SendqStats getSendqStats() const;
+    Reactor::FloodStats getFloodStats() const;
+    void collectMetrics(Metrics& metrics);
+    void requestReport();
+    size_t getUptime() const;
+
     int getServerFd() const;
     const std::string& getPassword() const;
-    const std::map<int, User*>& getUsers() const;
-    const std::map<std::string, Channel>& getChannels() const;
+    const std::string& getOperPassword() const;
+    const std::vector<User*>& getUsers() const;
+    const std::vector<CommandHandler*>& getCommandHandlers() const;
+    size_t getChannelCount() const;
 
     void addUser(int fd);
     void removeUser(int fd);
     User* getUser(int fd);
+    User* getUserByNick(const std::string& nick);
+    bool setNickname(User* user, const std::string& nick);
 
     Channel* getChannel(const std::string& name);
-    const Channel* getChannel(const std::string& name) const;
-    void createChannel(const std::string& name);
-    void removeChannel(const std::string& name);
+    Channel* createChannel(const std::string& name);
+    void removeChannel(Channel* channel);
 };
 
 #endif
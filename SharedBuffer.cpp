@@ -0,0 +1,113 @@
+#include "SharedBuffer.hpp"
+#include <cstring>
+
+__thread SharedBuffer::Block* SharedBuffer::pool = NULL;
+__thread size_t SharedBuffer::pooled = 0;
+
+SharedBuffer::SharedBuffer() : block(NULL) {
+}
+
+SharedBuffer::SharedBuffer(const std::string& data) : block(allocate()) {
+    block->data = data;
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer& other) : block(other.block) {
+    if (block) {
+        __sync_fetch_and_add(&block->refs, 1);
+    }
+}
+
+SharedBuffer& SharedBuffer::operator=(const SharedBuffer& other) {
+    if (block != other.block) {
+        if (other.block) {
+            __sync_fetch_and_add(&other.block->refs, 1);
+        }
+        release();
+        block = other.block;
+    }
+    return *this;
+}
+
+SharedBuffer::~SharedBuffer() {
+    release();
+}
+
+void SharedBuffer::release() {
+    if (block && __sync_sub_and_fetch(&block->refs, 1) == 0) {
+        recycle(block);
+    }
+    block = NULL;
+}
+
+SharedBuffer::Block* SharedBuffer::allocate() {
+    Block* fresh = pool;
+    if (fresh) {
+        pool = fresh->next;
+        --pooled;
+    } else {
+        fresh = new Block;
+    }
+    fresh->refs = 1;
+    fresh->next = NULL;
+    return fresh;
+}
+
+// Blocks land in the pool of whichever thread drops the last reference,
+// which for cross-reactor fanout is the receiving reactor.
+void SharedBuffer::recycle(Block* block) {
+    if (pooled >= POOL_LIMIT || block->data.capacity() > POOL_CAPACITY) {
+        delete block;
+        return;
+    }
+    block->data.clear();
+    block->next = pool;
+    pool = block;
+    ++pooled;
+}
+
+void SharedBuffer::drainPool() {
+    while (pool) {
+        Block* next = pool->next;
+        delete pool;
+        pool = next;
+    }
+    pooled = 0;
+}
+
+SharedBuffer SharedBuffer::fromLine(const std::string& message) {
+    SharedBuffer line = acquire();
+    line.block->data.reserve(message.length() + 2);
+    line.block->data.append(message);
+    line.block->data.append("\r\n", 2);
+    return line;
+}
+
+SharedBuffer SharedBuffer::acquire() {
+    SharedBuffer line;
+    line.block = allocate();
+    return line;
+}
+
+std::string& SharedBuffer::buffer() {
+    if (!block) {
+        block = allocate();
+    }
+    return block->data;
+}
+
+const char* SharedBuffer::data() const {
+    return block ? block->data.data() : "";
+}
+
+size_t SharedBuffer::length() const {
+    return block ? block->data.length() : 0;
+}
+
+bool SharedBuffer::empty() const {
+    return length() == 0;
+}
+
+bool SharedBuffer::startsWith(const char* prefix) const {
+    size_t count = strlen(prefix);
+    return length() >= count && memcmp(data(), prefix, count) == 0;
+}
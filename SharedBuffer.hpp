@@ -0,0 +1,57 @@
+#ifndef SHARED_BUFFER_HPP
+#define SHARED_BUFFER_HPP
+
+#include <string>
+#include <cstddef>
+
+// Immutable, reference-counted byte buffer. Copies share one allocation,
+// so a line fanned out to many connections is serialized once and freed
+// when the last queue holding it has flushed it. The count is atomic
+// because reactors hand buffers to each other across threads.
+//
+// Freed blocks go to a small per-thread pool with their string capacity
+// intact, so steady-state traffic serializes lines without allocating.
+class SharedBuffer {
+private:
+    struct Block {
+        volatile int refs;
+        Block* next;
+        std::string data;
+    };
+
+    enum {
+        POOL_LIMIT = 4096,
+        POOL_CAPACITY = 1024
+    };
+
+    static __thread Block* pool;
+    static __thread size_t pooled;
+
+    Block* block;
+
+    static Block* allocate();
+    static void recycle(Block* block);
+    void release();
+
+public:
+    SharedBuffer();
+    explicit SharedBuffer(const std::string& data);
+    SharedBuffer(const SharedBuffer& other);
+    SharedBuffer& operator=(const SharedBuffer& other);
+    ~SharedBuffer();
+
+    static SharedBuffer fromLine(const std::string& message);
+    static SharedBuffer acquire();
+    static void drainPool();
+
+    // Writable storage of a buffer fresh from acquire(), before any copy
+    // of it has been handed out.
+    std::string& buffer();
+
+    const char* data() const;
+    size_t length() const;
+    bool empty() const;
+    bool startsWith(const char* prefix) const;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "TimerWheel.hpp"
+#include <time.h>
+
+Timer::Timer() : prev(NULL), next(NULL), expires(0), level(-1), slot(0), data(NULL) {}
+
+bool Timer::isActive() const {
+    return level >= 0;
+}
+
+TimerWheel::TimerWheel(unsigned long long now_ms, unsigned long long tick_ms) :
+    tick_ms(tick_ms ? tick_ms : 1),
+    current(now_ms / this->tick_ms),
+    count(0) {
+    for (int level = 0; level < LEVELS; ++level) {
+        occupied[level] = 0;
+        for (int slot = 0; slot < SLOTS; ++slot) {
+            slots[level][slot] = NULL;
+        }
+    }
+}
+
+unsigned long long TimerWheel::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::link(Timer* timer) {
+    if (timer->expires < current) {
+        timer->expires = current;
+    }
+
+    unsigned long long delta = timer->expires - current;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    if (level == LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * LEVELS))) {
+        timer->expires = current + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+    }
+
+    int slot = (timer->expires >> (SLOT_BITS * level)) & SLOT_MASK;
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = slots[level][slot];
+    if (timer->next) {
+        timer->next->prev = timer;
+    }
+    slots[level][slot] = timer;
+    occupied[level] |= 1ULL << slot;
+}
+
+void TimerWheel::unlink(Timer* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        slots[timer->level][timer->slot] = timer->next;
+        if (!timer->next) {
+            occupied[timer->level] &= ~(1ULL << timer->slot);
+        }
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->level = -1;
+}
+
+void TimerWheel::cascade(int level) {
+    int slot = (current >> (SLOT_BITS * level)) & SLOT_MASK;
+    Timer* timer = slots[level][slot];
+    slots[level][slot] = NULL;
+    occupied[level] &= ~(1ULL << slot);
+
+    while (timer) {
+        Timer* next = timer->next;
+        link(timer);
+        timer = next;
+    }
+}
+
+void TimerWheel::schedule(Timer* timer, unsigned long long when_ms, void* data) {
+    if (timer->isActive()) {
+        unlink(timer);
+    } else {
+        count++;
+    }
+    timer->expires = (when_ms + tick_ms - 1) / tick_ms;
+    timer->data = data;
+    link(timer);
+}
+
+void TimerWheel::cancel(Timer* timer) {
+    if (timer->isActive()) {
+        unlink(timer);
+        count--;
+    }
+}
+
+Timer* TimerWheel::expire(unsigned long long now_ms) {
+    unsigned long long target = now_ms / tick_ms;
+
+    while (true) {
+        Timer* timer = slots[0][current & SLOT_MASK];
+        if (timer) {
+            unlink(timer);
+            count--;
+            return timer;
+        }
+        if (current >= target) {
+            return NULL;
+        }
+        if (count == 0) {
+            current = target;
+            continue;
+        }
+
+        current++;
+        for (int level = 1; level < LEVELS; ++level) {
+            if (current & ((1ULL << (SLOT_BITS * level)) - 1)) {
+                break;
+            }
+            cascade(level);
+        }
+    }
+}
+
+int TimerWheel::nextTimeout(unsigned long long now_ms) const {
+    if (count == 0) {
+        return -1;
+    }
+
+    unsigned long long due = 0;
+    bool found = false;
+    for (int level = 0; level < LEVELS; ++level) {
+        if (!occupied[level]) {
+            continue;
+        }
+
+        int shift = SLOT_BITS * level;
+        int start = ((current >> shift) + (level ? 1 : 0)) & SLOT_MASK;
+        unsigned long long rotated = (occupied[level] >> start) | (start ? occupied[level] << (SLOTS - start) : 0);
+        int distance = __builtin_ctzll(rotated);
+        unsigned long long candidate;
+        if (level == 0) {
+            candidate = current + distance;
+        } else {
+            candidate = ((current >> shift) + 1 + distance) << shift;
+        }
+        if (!found || candidate < due) {
+            due = candidate;
+            found = true;
+        }
+    }
+
+    unsigned long long due_ms = due * tick_ms;
+    if (due_ms <= now_ms) {
+        return 0;
+    }
+    unsigned long long wait = due_ms - now_ms;
+    return (wait > 0x7fffffffULL) ? 0x7fffffff : static_cast<int>(wait);
+}
+
+size_t TimerWheel::size() const {
+    return count;
+}
@@ -0,0 +1,56 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <cstddef>
+
+struct Timer {
+    Timer* prev;
+    Timer* next;
+    unsigned long long expires;
+    int level;
+    int slot;
+    void* data;
+
+    Timer();
+    bool isActive() const;
+};
+
+// Hierarchical timing wheel: 4 levels of 64 slots with a fixed tick.
+// schedule() and cancel() are O(1); timers on upper levels cascade down
+// when the lower level wraps around.
+class TimerWheel {
+public:
+    enum {
+        LEVELS = 4,
+        SLOT_BITS = 6,
+        SLOTS = 1 << SLOT_BITS,
+        SLOT_MASK = SLOTS - 1
+    };
+
+private:
+    unsigned long long tick_ms;
+    unsigned long long current;
+    unsigned long long occupied[LEVELS];
+    Timer* slots[LEVELS][SLOTS];
+    size_t count;
+
+    TimerWheel(const TimerWheel& other);
+    TimerWheel& operator=(const TimerWheel& other);
+
+    void link(Timer* timer);
+    void unlink(Timer* timer);
+    void cascade(int level);
+
+public:
+    TimerWheel(unsigned long long now_ms, unsigned long long tick_ms = 100);
+
+    void schedule(Timer* timer, unsigned long long when_ms, void* data);
+    void cancel(Timer* timer);
+    Timer* expire(unsigned long long now_ms);
+    int nextTimeout(unsigned long long now_ms) const;
+    size_t size() const;
+
+    static unsigned long long now();
+};
+
+#endif
@@ -0,0 +1,34 @@
+#include "TokenBucket.hpp"
+
+TokenBucket::TokenBucket() : level(0), stamp(0) {
+}
+
+// A bucket that has never been checked starts full.
+bool TokenBucket::ready(unsigned long long now_ms, int rate, int burst) {
+    long long full = static_cast<long long>(burst) * 1000;
+    if (stamp == 0) {
+        level = full;
+    } else if (now_ms > stamp) {
+        level += static_cast<long long>(now_ms - stamp) * rate;
+        if (level > full) {
+            level = full;
+        }
+    }
+    stamp = now_ms;
+    return level > 0;
+}
+
+void TokenBucket::charge(int cost) {
+    level -= static_cast<long long>(cost) * 1000;
+}
+
+bool TokenBucket::full(int burst) const {
+    return level >= static_cast<long long>(burst) * 1000;
+}
+
+unsigned long long TokenBucket::readyAt(int rate) const {
+    if (level > 0 || rate <= 0) {
+        return stamp;
+    }
+    return stamp + static_cast<unsigned long long>(-level) / rate + 1;
+}
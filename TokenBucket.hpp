@@ -0,0 +1,22 @@
+#ifndef TOKEN_BUCKET_HPP
+#define TOKEN_BUCKET_HPP
+
+// Per-connection input allowance. The bucket refills continuously at rate
+// tokens per second up to burst, and every executed command is charged
+// its cost afterwards, so one check and one subtraction per line is all
+// flood control costs. Levels are kept in thousandths of a token.
+class TokenBucket {
+private:
+    long long level;
+    unsigned long long stamp;
+
+public:
+    TokenBucket();
+
+    bool ready(unsigned long long now_ms, int rate, int burst);
+    void charge(int cost);
+    bool full(int burst) const;
+    unsigned long long readyAt(int rate) const;
+};
+
+#endif
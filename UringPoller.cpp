@@ -0,0 +1,535 @@
+#include "UringPoller.hpp"
+
+#ifdef IRC_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <poll.h>
+#include <stdint.h>
+#include <cstdlib>
+
+static const unsigned int RING_ENTRIES = 1024;
+static const unsigned int BUFFER_COUNT = 512;
+static const unsigned int BUFFER_SIZE = 4096;
+static const unsigned short BUFFER_GROUP = 0;
+static const unsigned long long PAYLOAD_MASK = (1ULL << 56) - 1;
+
+static bool kernelSupportsMultishotRecv() {
+    struct utsname info;
+    if (uname(&info) < 0) {
+        return false;
+    }
+    return std::atoi(info.release) >= 6;
+}
+
+UringPoller::UringPoller() :
+    ring_fd(-1),
+    sq_ring(MAP_FAILED),
+    cq_ring(MAP_FAILED),
+    sq_ring_size(0),
+    cq_ring_size(0),
+    sqes(NULL),
+    sqes_size(0),
+    sq_entries(0),
+    local_tail(0),
+    buf_ring(NULL),
+    buffers(NULL),
+    buf_tail(0) {
+    if (!kernelSupportsMultishotRecv()) {
+        throw std::runtime_error("kernel lacks multishot recv");
+    }
+
+    try {
+        setupRings(RING_ENTRIES);
+        setupBufferRing();
+    } catch (const std::exception& e) {
+        release();
+        throw;
+    }
+}
+
+UringPoller::~UringPoller() {
+    release();
+}
+
+void UringPoller::release() {
+    if (ring_fd != -1) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (sqes) {
+        munmap(sqes, sqes_size);
+        sqes = NULL;
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring != MAP_FAILED) {
+        munmap(sq_ring, sq_ring_size);
+    }
+    sq_ring = MAP_FAILED;
+    cq_ring = MAP_FAILED;
+    if (buf_ring) {
+        munmap(buf_ring, BUFFER_COUNT * sizeof(struct io_uring_buf));
+        buf_ring = NULL;
+    }
+    delete[] buffers;
+    buffers = NULL;
+
+    for (size_t i = 0; i < sends.size(); ++i) {
+        delete sends[i];
+    }
+    sends.clear();
+    idle_sends.clear();
+}
+
+void UringPoller::setupRings(unsigned int entries) {
+    struct io_uring_params params;
+    std::fill(reinterpret_cast<char*>(&params), reinterpret_cast<char*>(&params) + sizeof(params), 0);
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) {
+        ring_fd = -1;
+        throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        throw std::runtime_error("kernel lacks IORING_FEAT_EXT_ARG");
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        cq_ring_size = sq_ring_size;
+    }
+
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        throw std::runtime_error(std::string("io_uring SQ mmap failed: ") + strerror(errno));
+    }
+    if (single_mmap) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            throw std::runtime_error(std::string("io_uring CQ mmap failed: ") + strerror(errno));
+        }
+    }
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqe_map = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqe_map == MAP_FAILED) {
+        throw std::runtime_error(std::string("io_uring SQE mmap failed: ") + strerror(errno));
+    }
+    sqes = static_cast<struct io_uring_sqe*>(sqe_map);
+
+    char* sq = static_cast<char*>(sq_ring);
+    char* cq = static_cast<char*>(cq_ring);
+    sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    sq_entries = params.sq_entries;
+    for (unsigned int i = 0; i < sq_entries; ++i) {
+        sq_array[i] = i;
+    }
+    local_tail = *sq_tail;
+}
+
+void UringPoller::setupBufferRing() {
+    void* ring = mmap(NULL, BUFFER_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        throw std::runtime_error(std::string("Buffer ring mmap failed: ") + strerror(errno));
+    }
+    buf_ring = static_cast<struct io_uring_buf*>(ring);
+    buffers = new char[BUFFER_COUNT * BUFFER_SIZE];
+
+    struct io_uring_buf_reg reg;
+    std::fill(reinterpret_cast<char*>(&reg), reinterpret_cast<char*>(&reg) + sizeof(reg), 0);
+    reg.ring_addr = reinterpret_cast<uintptr_t>(buf_ring);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        throw std::runtime_error(std::string("Buffer ring registration failed: ") + strerror(errno));
+    }
+
+    for (unsigned int i = 0; i < BUFFER_COUNT; ++i) {
+        recycleBuffer(i);
+    }
+    __atomic_store_n(&buf_ring[0].resv, buf_tail, __ATOMIC_RELEASE);
+}
+
+void UringPoller::recycleBuffer(unsigned short bid) {
+    struct io_uring_buf* buf = &buf_ring[buf_tail & (BUFFER_COUNT - 1)];
+    buf->addr = reinterpret_cast<uintptr_t>(buffers + bid * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    buf_tail++;
+}
+
+struct io_uring_sqe* UringPoller::getSqe() {
+    unsigned int head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (local_tail - head >= sq_entries) {
+        submit(0, 0);
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= sq_entries) {
+            throw std::runtime_error("io_uring submission queue full");
+        }
+    }
+
+    struct io_uring_sqe* sqe = &sqes[local_tail & *sq_mask];
+    std::fill(reinterpret_cast<char*>(sqe), reinterpret_cast<char*>(sqe) + sizeof(*sqe), 0);
+    local_tail++;
+    return sqe;
+}
+
+int UringPoller::submit(unsigned int wait_for, int timeout_ms) {
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    unsigned int to_submit = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (!to_submit && !wait_for) {
+        return 0;
+    }
+
+    unsigned int flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void* argp = NULL;
+    size_t argsz = 0;
+    if (wait_for) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            std::fill(reinterpret_cast<char*>(&arg), reinterpret_cast<char*>(&arg) + sizeof(arg), 0);
+            arg.ts = reinterpret_cast<uintptr_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_for, flags, argp, argsz);
+}
+
+unsigned long long UringPoller::encode(int op, unsigned int gen, int fd) {
+    return (static_cast<unsigned long long>(op) << 56)
+        | (static_cast<unsigned long long>(gen & 0xffffff) << 32)
+        | static_cast<unsigned int>(fd);
+}
+
+void UringPoller::track(int fd, char kind) {
+    if (fd >= (int)kinds.size()) {
+        kinds.resize(fd + 1, 0);
+        recv_state.resize(fd + 1, 0);
+        poll_events.resize(fd + 1, 0);
+        generation.resize(fd + 1, 0);
+    }
+    kinds[fd] = kind;
+    recv_state[fd] = 0;
+}
+
+bool UringPoller::isCurrent(int fd, unsigned int gen) const {
+    return fd >= 0 && fd < (int)kinds.size() && kinds[fd] != 0 && (generation[fd] & 0xffffff) == gen;
+}
+
+void UringPoller::armAccept(int fd) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = encode(OP_ACCEPT, generation[fd], fd);
+}
+
+void UringPoller::armAcceptWait(int fd) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = encode(OP_ACCEPT_WAIT, generation[fd], fd);
+}
+
+void UringPoller::armRecv(int fd) {
+    recv_state[fd] |= RECV_ARMED;
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = (recv_state[fd] & RECV_SINGLE) ? 0 : IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = encode(OP_RECV, generation[fd], fd);
+}
+
+void UringPoller::armPoll(int fd) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = ((poll_events[fd] & READ) ? POLLIN : 0) | ((poll_events[fd] & WRITE) ? POLLOUT : 0);
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = encode(OP_POLL, generation[fd], fd);
+}
+
+void UringPoller::add(int fd, int events, bool edgeTriggered) {
+    (void)edgeTriggered;
+    track(fd, OP_POLL);
+    poll_events[fd] = events;
+    armPoll(fd);
+}
+
+void UringPoller::addListener(int fd) {
+    track(fd, OP_ACCEPT);
+    armAccept(fd);
+}
+
+void UringPoller::addConnection(int fd) {
+    track(fd, OP_RECV);
+    armRecv(fd);
+}
+
+void UringPoller::modify(int fd, int events) {
+    if (fd < 0 || fd >= (int)kinds.size()) {
+        return;
+    }
+    // A new mask needs a new poll; bumping the generation keeps the old
+    // one's final completion from re-arming it.
+    if (kinds[fd] == OP_POLL && poll_events[fd] != events) {
+        struct io_uring_sqe* sqe = getSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = encode(OP_POLL, generation[fd], fd);
+        sqe->user_data = encode(OP_CANCEL, 0, fd);
+        generation[fd]++;
+        poll_events[fd] = events;
+        armPoll(fd);
+        return;
+    }
+    if (kinds[fd] != OP_RECV) {
+        return;
+    }
+
+    bool paused = recv_state[fd] & RECV_PAUSED;
+    if (!(events & READ) && !paused) {
+        recv_state[fd] |= RECV_PAUSED;
+        if (recv_state[fd] & RECV_ARMED) {
+            cancelRecv(fd);
+        }
+    } else if ((events & READ) && paused) {
+        recv_state[fd] &= ~RECV_PAUSED;
+        recv_state[fd] |= RECV_SINGLE;
+        if (!(recv_state[fd] & RECV_ARMED)) {
+            armRecv(fd);
+        }
+    }
+}
+
+void UringPoller::cancelRecv(int fd) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = encode(OP_RECV, generation[fd], fd);
+    sqe->user_data = encode(OP_CANCEL, 0, fd);
+}
+
+void UringPoller::remove(int fd) {
+    if (fd < 0 || fd >= (int)kinds.size() || kinds[fd] == 0) {
+        return;
+    }
+    kinds[fd] = 0;
+    generation[fd]++;
+
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = encode(OP_CANCEL, 0, fd);
+    submit(0, 0);
+}
+
+bool UringPoller::completesIo() const {
+    return true;
+}
+
+bool UringPoller::submitSend(int fd, const OutputQueue& queue) {
+    if (fd < 0 || fd >= (int)kinds.size() || kinds[fd] != OP_RECV || queue.empty()) {
+        return false;
+    }
+
+    if (idle_sends.empty()) {
+        sends.push_back(new SendOp);
+        idle_sends.push_back(sends.back());
+    }
+    struct io_uring_sqe* sqe = getSqe();
+    SendOp* op = idle_sends.back();
+    idle_sends.pop_back();
+
+    op->fd = fd;
+    op->generation = generation[fd] & 0xffffff;
+    op->count = queue.gather(op->iov, op->held, OutputQueue::MAX_IOV);
+    std::fill(reinterpret_cast<char*>(&op->msg), reinterpret_cast<char*>(&op->msg) + sizeof(op->msg), 0);
+    op->msg.msg_iov = op->iov;
+    op->msg.msg_iovlen = op->count;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&op->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (static_cast<unsigned long long>(OP_SEND) << 56) | reinterpret_cast<uintptr_t>(op);
+    return true;
+}
+
+void UringPoller::complete(const struct io_uring_cqe& cqe, std::vector<Event>& events) {
+    int op = cqe.user_data >> 56;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    Event event;
+    event.events = 0;
+    event.result = cqe.res;
+    event.data = NULL;
+
+    if (op == OP_SEND) {
+        SendOp* send = reinterpret_cast<SendOp*>(static_cast<uintptr_t>(cqe.user_data & PAYLOAD_MASK));
+        if (isCurrent(send->fd, send->generation)) {
+            event.fd = send->fd;
+            event.events = SENT;
+            events.push_back(event);
+        }
+        for (int i = 0; i < send->count; ++i) {
+            send->held[i] = SharedBuffer();
+        }
+        idle_sends.push_back(send);
+        return;
+    }
+
+    int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+    unsigned int gen = (cqe.user_data >> 32) & 0xffffff;
+    bool current = isCurrent(fd, gen);
+    event.fd = fd;
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        used_buffers.push_back(bid);
+        event.data = buffers + bid * BUFFER_SIZE;
+    }
+
+    switch (op) {
+        case OP_ACCEPT:
+            if (!current) {
+                if (cqe.res >= 0) {
+                    close(cqe.res);
+                }
+                break;
+            }
+            if (cqe.res >= 0 || cqe.res == -EMFILE || cqe.res == -ENFILE) {
+                event.events = ACCEPT;
+                events.push_back(event);
+            }
+            if (cqe.res == -EMFILE || cqe.res == -ENFILE) {
+                armAcceptWait(fd);
+            } else if (!more) {
+                rearm_accept.push_back(std::make_pair(fd, gen));
+            }
+            break;
+
+        case OP_ACCEPT_WAIT:
+            if (current) {
+                rearm_accept.push_back(std::make_pair(fd, gen));
+            }
+            break;
+
+        case OP_RECV:
+            if (!current) {
+                break;
+            }
+            if (!more) {
+                recv_state[fd] &= ~RECV_ARMED;
+            }
+            if (cqe.res == -ECANCELED || cqe.res == -ENOBUFS || cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                rearm_recv.push_back(std::make_pair(fd, gen));
+                break;
+            }
+            // A full buffer means more is waiting: a multishot recv would
+            // keep taking buffers, so it is swapped for single-shot ones
+            // until a short read shows the client has been caught up with.
+            if (cqe.res >= 0 && cqe.res < static_cast<int>(BUFFER_SIZE)) {
+                recv_state[fd] &= ~RECV_SINGLE;
+            } else if (more && !(recv_state[fd] & (RECV_SINGLE | RECV_PAUSED))) {
+                recv_state[fd] |= RECV_SINGLE;
+                cancelRecv(fd);
+            }
+            event.events = DATA;
+            events.push_back(event);
+            if (cqe.res > 0 && !more) {
+                rearm_recv.push_back(std::make_pair(fd, gen));
+            }
+            break;
+
+        case OP_POLL:
+            if (!current) {
+                break;
+            }
+            if (cqe.res > 0) {
+                event.events = ((cqe.res & POLLIN) ? READ : 0) | ((cqe.res & POLLOUT) ? WRITE : 0)
+                    | ((cqe.res & POLLHUP) ? HANGUP : 0) | ((cqe.res & POLLERR) ? ERROR : 0);
+                events.push_back(event);
+            }
+            if (!more) {
+                armPoll(fd);
+            }
+            break;
+    }
+}
+
+int UringPoller::wait(std::vector<Event>& events, int timeout_ms) {
+    events.clear();
+
+    if (!used_buffers.empty()) {
+        for (size_t i = 0; i < used_buffers.size(); ++i) {
+            recycleBuffer(used_buffers[i]);
+        }
+        used_buffers.clear();
+        __atomic_store_n(&buf_ring[0].resv, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    for (size_t i = 0; i < rearm_recv.size(); ++i) {
+        int fd = rearm_recv[i].first;
+        if (isCurrent(fd, rearm_recv[i].second) && !(recv_state[fd] & (RECV_ARMED | RECV_PAUSED))) {
+            armRecv(fd);
+        }
+    }
+    rearm_recv.clear();
+    for (size_t i = 0; i < rearm_accept.size(); ++i) {
+        if (isCurrent(rearm_accept[i].first, rearm_accept[i].second)) {
+            armAccept(rearm_accept[i].first);
+        }
+    }
+    rearm_accept.clear();
+
+    unsigned int head = *cq_head;
+    unsigned int ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) - head;
+    int ret = submit(ready ? 0 : 1, timeout_ms);
+    if (ret < 0 && errno != ETIME) {
+        return -1;
+    }
+
+    unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        complete(cqes[head & *cq_mask], events);
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    return events.size();
+}
+
+const char* UringPoller::getName() const {
+    return "io_uring";
+}
+#endif
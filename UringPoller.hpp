@@ -0,0 +1,120 @@
+#ifndef URING_POLLER_HPP
+#define URING_POLLER_HPP
+
+#include "Poller.hpp"
+
+#ifdef IRC_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+// Completion backend on raw io_uring syscalls. Listeners use multishot
+// accept, connections use multishot recv into a registered buffer ring and
+// sends queued with submitSend() go out together with the next wait().
+// A send is a SENDMSG straight from the output queue's buffers; it holds
+// a reference to each one, so closing the connection mid-send is safe,
+// and its slot is kept for reuse once it completes.
+// Dropping READ through modify() cancels a connection's recv, which is
+// the only backpressure a completion backend has; restoring it re-arms.
+// A connection whose recv fills whole buffers is switched to single-shot
+// recvs until one comes back short, so a client with megabytes waiting
+// cannot take the whole buffer ring in one wait. Other descriptors get a
+// multishot poll for the READ/WRITE mask they were added or modified with.
+// An accept that fails for lack of descriptors is reported so the server
+// can shed the connection. It is only re-armed once a single-shot poll
+// sees another connection waiting, because the accept takes its
+// descriptor before it waits and would fail straight away.
+class UringPoller : public Poller {
+private:
+    enum {
+        OP_ACCEPT = 1,
+        OP_RECV = 2,
+        OP_POLL = 3,
+        OP_CANCEL = 4,
+        OP_SEND = 5,
+        OP_ACCEPT_WAIT = 6
+    };
+
+    enum {
+        RECV_ARMED = 1,
+        RECV_PAUSED = 2,
+        RECV_SINGLE = 4
+    };
+
+    struct SendOp {
+        int fd;
+        unsigned int generation;
+        int count;
+        struct msghdr msg;
+        struct iovec iov[OutputQueue::MAX_IOV];
+        SharedBuffer held[OutputQueue::MAX_IOV];
+    };
+
+    int ring_fd;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int sq_entries;
+    unsigned int local_tail;
+
+    struct io_uring_buf* buf_ring;
+    char* buffers;
+    unsigned short buf_tail;
+    std::vector<unsigned short> used_buffers;
+
+    std::vector<unsigned int> generation;
+    std::vector<char> kinds;
+    std::vector<char> recv_state;
+    std::vector<char> poll_events;
+    std::vector<std::pair<int, unsigned int> > rearm_recv;
+    std::vector<std::pair<int, unsigned int> > rearm_accept;
+    std::vector<SendOp*> sends;
+    std::vector<SendOp*> idle_sends;
+
+    UringPoller(const UringPoller& other);
+    UringPoller& operator=(const UringPoller& other);
+
+    void setupRings(unsigned int entries);
+    void setupBufferRing();
+    void release();
+    struct io_uring_sqe* getSqe();
+    int submit(unsigned int wait_for, int timeout_ms);
+    void recycleBuffer(unsigned short bid);
+    void armAccept(int fd);
+    void armAcceptWait(int fd);
+    void armRecv(int fd);
+    void cancelRecv(int fd);
+    void armPoll(int fd);
+    void track(int fd, char kind);
+    bool isCurrent(int fd, unsigned int gen) const;
+    void complete(const struct io_uring_cqe& cqe, std::vector<Event>& events);
+    static unsigned long long encode(int op, unsigned int generation, int fd);
+
+public:
+    UringPoller();
+    ~UringPoller();
+
+    void add(int fd, int events, bool edgeTriggered);
+    void modify(int fd, int events);
+    void remove(int fd);
+    int wait(std::vector<Event>& events, int timeout_ms);
+    const char* getName() const;
+
+    void addListener(int fd);
+    void addConnection(int fd);
+    bool completesIo() const;
+    bool submitSend(int fd, const OutputQueue& queue);
+};
+#endif
+
+#endif
@@ -1,14 +1,31 @@
 #include "User.hpp"
+#include "Reactor.hpp"
 
-User::User(int fd) :
+User::User(int fd, Reactor* reactor) :
     fd(fd),
+    generation(0),
+    reactor(reactor),
     registered(false),
     authenticated(false),
     invisible(false),
     operator_(false),
     wallops(false),
     restricted(false),
-    server_notices(false) {
+    server_notices(false),
+    writeInterest(false),
+    flushQueued(false),
+    closing(false),
+    sendqExceeded(false),
+    throttledSince(0),
+    readPaused(false),
+    readyQueued(false),
+    servedTick(0),
+    inputSince(0),
+    queuedSince(0),
+    keepalive(KEEPALIVE_REGISTRATION),
+    lastActivity(0),
+    pingSent(0),
+    fanoutEpoch(0) {
 }
 
 User::~User() {
@@ -19,14 +36,26 @@ User::~User() {
 
     channels.clear();
 
-    writeBuffer.clear();
-    readBuffer.clear(); 
+    sendQueue.clear();
+    readBuffer.clear();
 }
 
 int User::getFd() const {
     return fd;
 }
 
+unsigned int User::getGeneration() const {
+    return generation;
+}
+
+void User::setGeneration(unsigned int value) {
+    generation = value;
+}
+
+Reactor* User::getReactor() const {
+    return reactor;
+}
+
 const std::string& User::getNickname() const {
     return nickname;
 }
@@ -39,11 +68,15 @@ const std::string& User::getRealname() const {
     return realname;
 }
 
+const std::string& User::getPrefix() const {
+    return prefix;
+}
+
 bool User::isRegistered() const {
     return registered;
 }
 
-const std::set<std::string>& User::getCurrentChannels() const {
+const std::vector<Channel*>& User::getCurrentChannels() const {
     return channels;
 }
 
@@ -59,10 +92,23 @@ std::string User::getModeFlags() const {
 
 void User::setNickname(const std::string& nick) {
     nickname = nick;
+    rebuildPrefix();
 }
 
 void User::setUsername(const std::string& user) {
     username = user;
+    rebuildPrefix();
+}
+
+// Serialized "nick!~user@localhost" source, kept in step with NICK and
+// USER so outgoing messages copy it instead of rebuilding it per line.
+void User::rebuildPrefix() {
+    prefix.clear();
+    prefix.reserve(nickname.length() + username.length() + 12);
+    prefix.append(nickname);
+    prefix.append("!~", 2);
+    prefix.append(username);
+    prefix.append("@localhost", 10);
 }
 
 void User::setRealname(const std::string& real) {
@@ -70,6 +116,9 @@ void User::setRealname(const std::string& real) {
 }
 
 void User::setRegistered(bool value) {
+    if (value && !registered && reactor) {
+        reactor->getIoStats().registrations++;
+    }
     registered = value;
 }
 
@@ -95,23 +144,36 @@ void User::setModeFlags(const std::string& modes) {
     }
 }
 
-void User::joinChannel(const std::string& channel) {
-    channels.insert(channel);
+void User::joinChannel(Channel* channel) {
+    if (!isInChannel(channel)) {
+        channels.push_back(channel);
+    }
 }
 
-void User::leaveChannel(const std::string& channel) {
-    channels.erase(channel);
+void User::leaveChannel(Channel* channel) {
+    for (size_t i = 0; i < channels.size(); ++i) {
+        if (channels[i] == channel) {
+            channels[i] = channels.back();
+            channels.pop_back();
+            return;
+        }
+    }
 }
 
-bool User::isInChannel(const std::string& channel_name) const {
-    return channels.find(channel_name) != channels.end();
+bool User::isInChannel(const Channel* channel) const {
+    for (size_t i = 0; i < channels.size(); ++i) {
+        if (channels[i] == channel) {
+            return true;
+        }
+    }
+    return false;
 }
 
-std::string& User::getWriteBuffer() const {
-    return writeBuffer;
+OutputQueue& User::getSendQueue() const {
+    return sendQueue;
 }
 
-std::string& User::getReadBuffer() {
+ReadBuffer& User::getReadBuffer() {
     return readBuffer;
 }
 
@@ -119,26 +181,227 @@ void User::clearReadBuffer() {
     readBuffer.clear();
 }
 
-void User::appendToReadBuffer(const std::string& data) {
-    readBuffer += data;
+bool User::hasWriteInterest() const {
+    return writeInterest;
+}
+
+void User::setWriteInterest(bool value) {
+    writeInterest = value;
+}
+
+bool User::isFlushQueued() const {
+    return flushQueued;
+}
+
+void User::setFlushQueued(bool value) {
+    flushQueued = value;
+}
+
+bool User::isClosing() const {
+    return closing;
+}
+
+void User::setClosing(bool value) {
+    closing = value;
+}
+
+Timer& User::getTimer() {
+    return timer;
+}
+
+Timer& User::getFloodTimer() {
+    return floodTimer;
+}
+
+TokenBucket& User::getFloodBucket() {
+    return floodBucket;
+}
+
+// Lines are waiting in the read buffer for the bucket to refill.
+bool User::isThrottled() const {
+    return floodTimer.isActive();
+}
+
+unsigned long long User::getThrottledSince() const {
+    return throttledSince;
+}
+
+void User::setThrottledSince(unsigned long long now) {
+    throttledSince = now;
+}
+
+bool User::isReadPaused() const {
+    return readPaused;
+}
+
+void User::setReadPaused(bool value) {
+    readPaused = value;
+}
+
+bool User::isReadyQueued() const {
+    return readyQueued;
+}
+
+void User::setReadyQueued(bool value) {
+    readyQueued = value;
+}
+
+unsigned long long User::getServedTick() const {
+    return servedTick;
+}
+
+void User::setServedTick(unsigned long long value) {
+    servedTick = value;
+}
+
+std::string& User::getInputBacklog() {
+    return inputBacklog;
+}
+
+// The backlog remembers when each received chunk arrived, as pairs of
+// end offset and stamp, so lines fed from it later are timed from their
+// own recv rather than the oldest one still waiting.
+void User::appendBacklog(const char* data, size_t length, unsigned long long stamp) {
+    if (length == 0) {
+        return;
+    }
+    inputBacklog.append(data, length);
+    if (!backlogStamps.empty() && backlogStamps.back().second == stamp) {
+        backlogStamps.back().first = inputBacklog.size();
+    } else {
+        backlogStamps.push_back(std::make_pair(inputBacklog.size(), stamp));
+    }
+}
+
+void User::consumeBacklog(size_t length) {
+    inputBacklog.erase(0, length);
+    size_t dropped = 0;
+    while (dropped < backlogStamps.size() && backlogStamps[dropped].first <= length) {
+        dropped++;
+    }
+    backlogStamps.erase(backlogStamps.begin(), backlogStamps.begin() + dropped);
+    for (size_t i = 0; i < backlogStamps.size(); ++i) {
+        backlogStamps[i].first -= length;
+    }
+}
+
+unsigned long long User::getBacklogStamp(size_t offset) const {
+    for (size_t i = 0; i < backlogStamps.size(); ++i) {
+        if (offset < backlogStamps[i].first) {
+            return backlogStamps[i].second;
+        }
+    }
+    return inputSince;
+}
+
+// Stamp of the recv that brought in the oldest input still waiting.
+unsigned long long User::getInputSince() const {
+    return inputSince;
+}
+
+void User::setInputSince(unsigned long long ns) {
+    inputSince = ns;
+}
+
+// Stamp of the oldest line in the send queue, taken from the reactor's
+// clock when the line was queued on an empty queue.
+unsigned long long User::getQueuedSince() const {
+    return queuedSince;
+}
+
+User::Keepalive User::getKeepalive() const {
+    return keepalive;
+}
+
+void User::setKeepalive(Keepalive state) {
+    keepalive = state;
+}
+
+unsigned long long User::getLastActivity() const {
+    return lastActivity;
+}
+
+void User::setLastActivity(unsigned long long now) {
+    lastActivity = now;
+}
+
+unsigned long long User::getPingSent() const {
+    return pingSent;
+}
+
+void User::setPingSent(unsigned long long now) {
+    pingSent = now;
+}
+
+// Returns false if the user was already stamped for this fan-out.
+bool User::stampFanout(unsigned long long epoch) {
+    if (fanoutEpoch == epoch) {
+        return false;
+    }
+    fanoutEpoch = epoch;
+    return true;
 }
 
 void User::sendMessage(const std::string& message) const {
+    sendMessage(SharedBuffer::fromLine(message));
+}
+
+void User::sendMessage(const SharedBuffer& line, OutputQueue::Priority priority) const {
     if (fd > 0) {
-        if (message.substr(0, 7) == ":server") {
-            writeBuffer += message + "\r\n";
-            return;
+        Reactor* current = Reactor::current();
+        if (current) {
+            current->getIoStats().lines_out++;
+        }
+        if (line.startsWith(":server")) {
+            queueOutput(line, priority);
+        } else if (!registered) {
+            queueOutput(SharedBuffer(":server 451 :You have not registered\r\n"));
+        } else if (nickname.empty() || username.empty()) {
+            queueOutput(SharedBuffer(":server 451 :You must set both nickname and username before sending messages\r\n"));
+        } else {
+            queueOutput(line, priority);
         }
+    }
+}
+
+void User::queueOutput(const SharedBuffer& line, OutputQueue::Priority priority) const {
+    Reactor* current = Reactor::current();
+    if (reactor && current && reactor != current) {
+        Reactor::Delivery delivery;
+        delivery.fd = fd;
+        delivery.generation = generation;
+        delivery.line = line;
+        delivery.priority = priority;
+        current->post(reactor, delivery);
+        return;
+    }
 
-        if (!registered) {
-            writeBuffer += ":server 451 :You have not registered\r\n";
+    if (sendqExceeded) {
+        return;
+    }
+    switch (sendQueue.admit(line.length(), priority)) {
+        case OutputQueue::ADMIT:
+            break;
+        case OutputQueue::DROP:
+            if (reactor) {
+                reactor->getSendqStats().dropped_lines++;
+                reactor->getSendqStats().dropped_bytes += line.length();
+            }
             return;
-        }
-        if (nickname.empty() || username.empty()) {
-            writeBuffer += ":server 451 :You must set both nickname and username before sending messages\r\n";
+        case OutputQueue::OVERFLOW:
+            sendqExceeded = true;
+            if (reactor) {
+                reactor->markOverflow(fd);
+            }
             return;
-        }
-        writeBuffer += message + "\r\n";
+    }
+
+    if (reactor && sendQueue.empty()) {
+        queuedSince = reactor->getStampNs();
+    }
+    sendQueue.push(line);
+    if (reactor && !writeInterest && !flushQueued) {
+        reactor->markDirty(fd);
     }
 }
 
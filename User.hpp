@@ -2,47 +2,121 @@
 #define USER_HPP
 
 #include <string>
-#include <set>
+#include <vector>
+#include <utility>
 #include <sys/socket.h>
 #include <cerrno>
 #include <cstring>
 #include <unistd.h>
 #include <iostream>
+#include "TimerWheel.hpp"
+#include "OutputQueue.hpp"
+#include "ReadBuffer.hpp"
+#include "TokenBucket.hpp"
+
+class Reactor;
+class Channel;
 
 class User {
+public:
+    enum Keepalive {
+        KEEPALIVE_REGISTRATION,
+        KEEPALIVE_PING,
+        KEEPALIVE_PONG
+    };
+
 private:
     int fd;
+    unsigned int generation;
+    Reactor* reactor;
     std::string nickname;
     std::string username;
     std::string realname;
+    std::string prefix;
     bool registered;
     bool authenticated;
-    std::set<std::string> channels;
+    std::vector<Channel*> channels;
     std::string modeFlags;
     bool invisible;
     bool operator_;
     bool wallops;
     bool restricted;
     bool server_notices;
-    mutable std::string writeBuffer;
-    std::string readBuffer;
+    mutable OutputQueue sendQueue;
+    ReadBuffer readBuffer;
+    bool writeInterest;
+    bool flushQueued;
+    bool closing;
+    mutable bool sendqExceeded;
+    Timer timer;
+    Timer floodTimer;
+    TokenBucket floodBucket;
+    unsigned long long throttledSince;
+    bool readPaused;
+    bool readyQueued;
+    unsigned long long servedTick;
+    std::string inputBacklog;
+    std::vector<std::pair<size_t, unsigned long long> > backlogStamps;
+    unsigned long long inputSince;
+    mutable unsigned long long queuedSince;
+    Keepalive keepalive;
+    unsigned long long lastActivity;
+    unsigned long long pingSent;
+    unsigned long long fanoutEpoch;
+
+    void rebuildPrefix();
 
 public:
-    User(int fd);
+    User(int fd, Reactor* reactor = NULL);
     ~User();
 
     int getFd() const;
+    unsigned int getGeneration() const;
+    void setGeneration(unsigned int value);
+    Reactor* getReactor() const;
     const std::string& getNickname() const;
     const std::string& getUsername() const;
     const std::string& getRealname() const;
+    const std::string& getPrefix() const;
     bool isRegistered() const;
     bool isAuthenticated() const;
-    const std::set<std::string>& getCurrentChannels() const;
+    const std::vector<Channel*>& getCurrentChannels() const;
     std::string getModeFlags() const;
-    std::string& getWriteBuffer() const;
-    std::string& getReadBuffer();
+    OutputQueue& getSendQueue() const;
+    ReadBuffer& getReadBuffer();
     void clearReadBuffer();
-    void appendToReadBuffer(const std::string& data);
+    bool hasWriteInterest() const;
+    void setWriteInterest(bool value);
+    bool isFlushQueued() const;
+    void setFlushQueued(bool value);
+    bool isClosing() const;
+    void setClosing(bool value);
+    Timer& getTimer();
+    Timer& getFloodTimer();
+    TokenBucket& getFloodBucket();
+    bool isThrottled() const;
+    unsigned long long getThrottledSince() const;
+    void setThrottledSince(unsigned long long now);
+    bool isReadPaused() const;
+    void setReadPaused(bool value);
+    bool isReadyQueued() const;
+    void setReadyQueued(bool value);
+    unsigned long long getServedTick() const;
+    void setServedTick(unsigned long long value);
+    std::string& getInputBacklog();
+    void appendBacklog(const char* data, size_t length, unsigned long long stamp);
+    void consumeBacklog(size_t length);
+    unsigned long long getBacklogStamp(size_t offset) const;
+    unsigned long long getInputSince() const;
+    void setInputSince(unsigned long long ns);
+    unsigned long long getQueuedSince() const;
+    Keepalive getKeepalive() const;
+    void setKeepalive(Keepalive state);
+    unsigned long long getLastActivity() const;
+    void setLastActivity(unsigned long long now);
+    unsigned long long getPingSent() const;
+    void setPingSent(unsigned long long now);
+    bool stampFanout(unsigned long long epoch);
 
     void setNickname(const std::string& nick);
     void setUsername(const std::string& user);
@@ -51,11 +125,13 @@ public:
     void setAuthenticated(bool value);
     void setModeFlags(const std::string& modes);
 
-    void joinChannel(const std::string& channel);
-    void leaveChannel(const std::string& channel);
-    bool isInChannel(const std::string& channel_name) const;
+    void joinChannel(Channel* channel);
+    void leaveChannel(Channel* channel);
+    bool isInChannel(const Channel* channel) const;
 
     void sendMessage(const std::string& message) const;
+    void sendMessage(const SharedBuffer& line, OutputQueue::Priority priority = OutputQueue::NORMAL) const;
+    void queueOutput(const SharedBuffer& line, OutputQueue::Priority priority = OutputQueue::NORMAL) const;
 
     void setInvisible(bool value);
     void setOperator(bool value);
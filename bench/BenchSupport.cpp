@@ -0,0 +1,48 @@
+#include "BenchSupport.hpp"
+#include <new>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+size_t allocation_count = 0;
+size_t allocated_bytes = 0;
+
+// Called through a volatile pointer so the compiler cannot pair a new
+// with its delete and elide both.
+static void (*volatile release)(void*) = std::free;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+    allocated_bytes += size;
+    allocation_count++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) throw() {
+    release(p);
+}
+
+double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int raiseFdLimit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        return 0;
+    }
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+    return rl.rlim_cur;
+}
+
+int openSink() {
+    return open("/dev/null", O_WRONLY | O_CLOEXEC);
+}
@@ -0,0 +1,37 @@
+#ifndef BENCH_SUPPORT_HPP
+#define BENCH_SUPPORT_HPP
+
+#include "User.hpp"
+#include <cstddef>
+#include <string>
+
+// Shared by the in-process benches. Linking BenchSupport.cpp replaces the
+// global operator new, so the counters below see every heap allocation
+// the program makes.
+extern size_t allocation_count;
+extern size_t allocated_bytes;
+
+double nowNs();
+
+// Raises the soft descriptor limit to the hard one and returns the result.
+int raiseFdLimit();
+
+// A descriptor on /dev/null: writes to it succeed without a socket.
+int openSink();
+
+// A registered user writing to /dev/null, built without a handshake so
+// setup stays cheap at large populations. NULL once descriptors run out.
+// Inline so benches that never build users need not link User.cpp.
+inline User* newSinkUser(const std::string& nick) {
+    int fd = openSink();
+    if (fd < 0) {
+        return NULL;
+    }
+    User* user = new User(fd);
+    user->setNickname(nick);
+    user->setUsername(nick);
+    user->setRegistered(true);
+    return user;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "User.hpp"
+#include "SharedBuffer.hpp"
+#include "BenchSupport.hpp"
+#include <iostream>
+#include <iomanip>
+#include <deque>
+#include <vector>
+#include <cstdlib>
+
+// Counts heap bytes allocated by one channel broadcast, comparing a
+// private copy of the line per member with one shared buffer whose
+// references are queued on every member.
+
+static void report(const char* name, int members, int rounds, size_t bytes, size_t count, double elapsed) {
+    std::cout << std::left << std::setw(14) << name
+              << std::right << std::setw(6) << members << " members  "
+              << std::setw(10) << bytes / rounds << " bytes/broadcast  "
+              << std::setw(6) << count / rounds << " allocs/broadcast  "
+              << std::fixed << std::setprecision(1) << std::setw(9)
+              << elapsed / rounds / 1000 << " us/broadcast" << std::endl;
+}
+
+static void benchCopy(const std::string& message, int members, int rounds) {
+    std::vector<std::deque<std::string> > queues(members);
+    size_t bytes = 0;
+    size_t count = 0;
+    double elapsed = 0;
+
+    for (int r = 0; r < rounds; ++r) {
+        size_t bytes_before = allocated_bytes;
+        size_t count_before = allocation_count;
+        double start = nowNs();
+        for (int i = 0; i < members; ++i) {
+            queues[i].push_back(message + "\r\n");
+        }
+        elapsed += nowNs() - start;
+        bytes += allocated_bytes - bytes_before;
+        count += allocation_count - count_before;
+
+        for (int i = 0; i < members; ++i) {
+            queues[i].pop_front();
+        }
+    }
+    report("per-member", members, rounds, bytes, count, elapsed);
+}
+
+static void benchShared(const std::string& message, std::vector<User*>& users, int rounds) {
+    size_t bytes = 0;
+    size_t count = 0;
+    double elapsed = 0;
+
+    for (int r = 0; r < rounds; ++r) {
+        size_t bytes_before = allocated_bytes;
+        size_t count_before = allocation_count;
+        double start = nowNs();
+        SharedBuffer line = SharedBuffer::fromLine(message);
+        for (size_t i = 0; i < users.size(); ++i) {
+            users[i]->sendMessage(line);
+        }
+        elapsed += nowNs() - start;
+        bytes += allocated_bytes - bytes_before;
+        count += allocation_count - count_before;
+
+        for (size_t i = 0; i < users.size(); ++i) {
+            OutputQueue& queue = users[i]->getSendQueue();
+            queue.consume(queue.byteCount());
+        }
+    }
+    report("shared", users.size(), rounds, bytes, count, elapsed);
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = (argc > 1) ? std::atoi(argv[1]) : 200;
+    std::string message = ":nick!user@localhost PRIVMSG #bench :" + std::string(400, 'x');
+    const int sizes[] = { 10, 500, 5000 };
+
+    raiseFdLimit();
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        std::vector<User*> users;
+        for (int i = 0; i < sizes[s]; ++i) {
+            User* user = newSinkUser("member");
+            if (!user) {
+                break;
+            }
+            users.push_back(user);
+        }
+
+        benchCopy(message, users.size(), rounds);
+        benchShared(message, users, rounds);
+
+        for (size_t i = 0; i < users.size(); ++i) {
+            delete users[i];
+        }
+    }
+    return 0;
+}
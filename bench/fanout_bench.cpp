@@ -0,0 +1,100 @@
+#include "User.hpp"
+#include "Channel.hpp"
+#include "BenchSupport.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+
+// Mass QUIT on a network with heavy channel overlap: one broadcast per
+// shared channel versus one delivery per distinct neighbour.
+
+static size_t drain(std::vector<User*>& users) {
+    size_t lines = 0;
+    for (size_t i = 0; i < users.size(); ++i) {
+        OutputQueue& queue = users[i]->getSendQueue();
+        lines += queue.messageCount();
+        queue.consume(queue.byteCount());
+    }
+    return lines;
+}
+
+static void report(const char* name, size_t quits, size_t lines, double elapsed) {
+    std::cout << std::left << std::setw(16) << name << std::right
+              << std::setw(10) << lines / quits << " lines/quit  "
+              << std::fixed << std::setprecision(1) << std::setw(10)
+              << elapsed / quits / 1000 << " us/quit" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int population = (argc > 1) ? std::atoi(argv[1]) : 5000;
+    int channel_count = (argc > 2) ? std::atoi(argv[2]) : 200;
+    int per_user = (argc > 3) ? std::atoi(argv[3]) : 20;
+
+    raiseFdLimit();
+
+    std::vector<Channel*> channels;
+    for (int i = 0; i < channel_count; ++i) {
+        std::ostringstream name;
+        name << "#chan" << i;
+        channels.push_back(new Channel(name.str()));
+    }
+
+    std::srand(42);
+    std::vector<User*> users;
+    for (int i = 0; i < population; ++i) {
+        std::ostringstream nick;
+        nick << "user" << i;
+        User* user = newSinkUser(nick.str());
+        if (!user) {
+            break;
+        }
+        for (int j = 0; j < per_user; ++j) {
+            Channel* channel = channels[std::rand() % channel_count];
+            channel->addUser(user);
+            user->joinChannel(channel);
+        }
+        users.push_back(user);
+    }
+    std::cout << users.size() << " users, " << channel_count << " channels, "
+              << per_user << " joins each" << std::endl;
+
+    size_t lines = 0;
+    double elapsed = 0;
+    for (size_t i = 0; i < users.size(); ++i) {
+        double start = nowNs();
+        std::string quit_msg = ":" + users[i]->getNickname() + " QUIT :bye";
+        const std::vector<Channel*>& joined = users[i]->getCurrentChannels();
+        for (size_t c = 0; c < joined.size(); ++c) {
+            SharedBuffer line = SharedBuffer::fromLine(quit_msg);
+            const std::vector<Channel::Member>& members = joined[c]->getMembers();
+            for (size_t m = 0; m < members.size(); ++m) {
+                if ((members[m].flags & Channel::MEMBER) && members[m].user != users[i]) {
+                    members[m].user->sendMessage(line);
+                }
+            }
+        }
+        elapsed += nowNs() - start;
+        lines += drain(users);
+    }
+    report("per channel", users.size(), lines, elapsed);
+
+    lines = 0;
+    elapsed = 0;
+    for (size_t i = 0; i < users.size(); ++i) {
+        double start = nowNs();
+        Channel::broadcastToNeighbors(users[i], SharedBuffer::fromLine(":" + users[i]->getNickname() + " QUIT :bye"), false);
+        elapsed += nowNs() - start;
+        lines += drain(users);
+    }
+    report("per neighbour", users.size(), lines, elapsed);
+
+    for (size_t i = 0; i < users.size(); ++i) {
+        delete users[i];
+    }
+    for (size_t i = 0; i < channels.size(); ++i) {
+        delete channels[i];
+    }
+    return 0;
+}
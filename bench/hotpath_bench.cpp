@@ -0,0 +1,336 @@
+#include "Server.hpp"
+#include "CommandHandler.hpp"
+#include "IrcMessage.hpp"
+#include "BenchSupport.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+// Time and heap allocations per operation for each hot path on its own:
+// parsing, comma lists, dispatch, channel broadcast by size, nick lookup,
+// teardown and input framing. Users write to /dev/null and their queues
+// are emptied between batches, outside the timed region, so no socket or
+// network is involved. Framing copies chunks into the read buffer the way
+// the completion backend does, in place of recv().
+
+class Meter {
+private:
+    size_t ops;
+    size_t allocations;
+    double elapsed;
+    size_t mark_allocations;
+    double mark_time;
+
+public:
+    Meter() : ops(0), allocations(0), elapsed(0), mark_allocations(0), mark_time(0) {}
+
+    void start() {
+        mark_allocations = allocation_count;
+        mark_time = nowNs();
+    }
+
+    void stop(size_t count) {
+        elapsed += nowNs() - mark_time;
+        allocations += allocation_count - mark_allocations;
+        ops += count;
+    }
+
+    void report(const std::string& name) const {
+        std::cout << std::left << std::setw(26) << name << std::right
+                  << std::setw(10) << ops << " ops  "
+                  << std::fixed << std::setprecision(2) << std::setw(8)
+                  << static_cast<double>(allocations) / ops << " allocs/op  "
+                  << std::setprecision(1) << std::setw(10)
+                  << elapsed / ops << " ns/op" << std::endl;
+    }
+};
+
+static void drain(const std::vector<User*>& users) {
+    for (size_t i = 0; i < users.size(); ++i) {
+        OutputQueue& queue = users[i]->getSendQueue();
+        queue.consume(queue.byteCount());
+    }
+}
+
+static std::string nickFor(size_t index) {
+    std::ostringstream nick;
+    nick << "user" << index;
+    return nick.str();
+}
+
+// Registers a user on /dev/null without going through the handshake, so
+// setup stays cheap at ten thousand users.
+static User* addUser(Server& server, const std::string& nick) {
+    int fd = openSink();
+    if (fd < 0) {
+        return NULL;
+    }
+    server.addUser(fd);
+    User* user = server.getUser(fd);
+    user->setAuthenticated(true);
+    user->setUsername(nick);
+    server.setNickname(user, nick);
+    user->setRegistered(true);
+    return user;
+}
+
+static void join(Server& server, User* user, const std::string& name) {
+    Channel* channel = server.createChannel(name);
+    channel->addUser(user);
+    user->joinChannel(channel);
+}
+
+static void benchParse(int rounds) {
+    const char* lines[] = {
+        "PRIVMSG #bench :the quick brown fox jumps over the lazy dog",
+        ":nick!user@host PRIVMSG target :hello there",
+        "@time=2024-01-01T00:00:00Z;msgid=abc :server NOTICE * :tagged",
+        "JOIN #a,#b,#c key1,key2",
+        "MODE #bench +ik secret",
+        "PING :1234567890"
+    };
+    const size_t count = sizeof(lines) / sizeof(lines[0]);
+    size_t lengths[count];
+    for (size_t i = 0; i < count; ++i) {
+        lengths[i] = strlen(lines[i]);
+    }
+
+    IrcMessage message;
+    std::vector<std::string> params;
+    Meter parse;
+    Meter copy;
+    for (int r = 0; r < rounds; ++r) {
+        parse.start();
+        for (size_t i = 0; i < count; ++i) {
+            IrcMessage::parse(lines[i], lengths[i], message);
+        }
+        parse.stop(count);
+        copy.start();
+        for (size_t i = 0; i < count; ++i) {
+            IrcMessage::parse(lines[i], lengths[i], message);
+            message.copyParams(params);
+        }
+        copy.stop(count);
+    }
+    parse.report("parse");
+    copy.report("parse + copyParams");
+
+    std::string list = "#alpha,#beta, #gamma,#delta";
+    Meter split;
+    for (int r = 0; r < rounds; ++r) {
+        split.start();
+        CommandHandler::splitByComma(list);
+        split.stop(1);
+    }
+    split.report("splitByComma (4 names)");
+}
+
+static void benchDispatch(CommandHandler& handler, const std::vector<User*>& users, int rounds) {
+    const int batch = 64;
+    User* sender = users[0];
+    std::vector<std::string> ping(1, ":token");
+    std::vector<std::string> direct;
+    direct.push_back(users[1]->getNickname());
+    direct.push_back(":the quick brown fox jumps over the lazy dog");
+    std::vector<std::string> channel;
+    channel.push_back("#m10");
+    channel.push_back(":the quick brown fox jumps over the lazy dog");
+    const char* line = "PRIVMSG user1 :the quick brown fox jumps over the lazy dog";
+    size_t length = strlen(line);
+
+    Meter pings;
+    Meter directs;
+    Meter channels;
+    Meter parsed;
+    for (int r = 0; r < rounds; r += batch) {
+        pings.start();
+        for (int i = 0; i < batch; ++i) {
+            handler.executeCommand(sender, "PING", ping);
+        }
+        pings.stop(batch);
+        drain(users);
+        directs.start();
+        for (int i = 0; i < batch; ++i) {
+            handler.executeCommand(sender, "PRIVMSG", direct);
+        }
+        directs.stop(batch);
+        drain(users);
+        channels.start();
+        for (int i = 0; i < batch; ++i) {
+            handler.executeCommand(sender, "PRIVMSG", channel);
+        }
+        channels.stop(batch);
+        drain(users);
+        parsed.start();
+        for (int i = 0; i < batch; ++i) {
+            handler.parseMessage(sender, line, length);
+        }
+        parsed.stop(batch);
+        drain(users);
+    }
+    pings.report("execute PING");
+    directs.report("execute PRIVMSG nick");
+    channels.report("execute PRIVMSG #m10");
+    parsed.report("parseMessage PRIVMSG nick");
+}
+
+static void benchBroadcast(Server& server, const std::vector<User*>& users, int rounds) {
+    const int sizes[] = { 10, 1000, 10000 };
+    SharedBuffer line = SharedBuffer::fromLine(":user0!~user0@localhost PRIVMSG #m :the quick brown fox");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        if (static_cast<size_t>(sizes[s]) > users.size()) {
+            break;
+        }
+        std::ostringstream name;
+        name << "#m" << sizes[s];
+        Channel* channel = server.getChannel(name.str());
+        int count = std::max(1, rounds / sizes[s]);
+        channel->broadcast(users[0]->getFd(), line, &server);
+        drain(users);
+        Meter meter;
+        for (int r = 0; r < count; ++r) {
+            meter.start();
+            channel->broadcast(users[0]->getFd(), line, &server);
+            meter.stop(1);
+            drain(users);
+        }
+        meter.report("broadcast to " + name.str().substr(2));
+    }
+}
+
+static void benchLookup(Server& server, const std::vector<User*>& users, int rounds) {
+    std::vector<std::string> hits;
+    std::vector<std::string> misses;
+    for (size_t i = 0; i < 1024; ++i) {
+        hits.push_back(nickFor((i * 7919) % users.size()));
+        misses.push_back("nobody" + nickFor(i).substr(4));
+    }
+    Meter hit;
+    Meter miss;
+    size_t found = 0;
+    for (int r = 0; r < rounds; r += 1024) {
+        hit.start();
+        for (size_t i = 0; i < hits.size(); ++i) {
+            found += server.getUserByNick(hits[i]) != NULL;
+        }
+        hit.stop(hits.size());
+        miss.start();
+        for (size_t i = 0; i < misses.size(); ++i) {
+            found += server.getUserByNick(misses[i]) != NULL;
+        }
+        miss.stop(misses.size());
+    }
+    if (found == 0) {
+        std::cout << "no nick found" << std::endl;
+    }
+    hit.report("getUserByNick hit");
+    miss.report("getUserByNick miss");
+}
+
+// Each victim sits in a shared 100-member room and a channel of its own,
+// so a removal both prunes a busy membership list and frees a channel.
+static void benchTeardown(Server& server, int rounds) {
+    const int batch = 1000;
+    Meter meter;
+    for (int r = 0; r < rounds; r += batch) {
+        std::vector<User*> victims;
+        for (int i = 0; i < batch; ++i) {
+            User* user = addUser(server, "gone" + nickFor(i).substr(4));
+            if (!user) {
+                break;
+            }
+            std::ostringstream own;
+            own << "#own" << i;
+            join(server, user, own.str());
+            std::ostringstream room;
+            room << "#room" << i / 100;
+            join(server, user, room.str());
+            victims.push_back(user);
+        }
+        meter.start();
+        for (size_t i = 0; i < victims.size(); ++i) {
+            server.removeUser(victims[i]->getFd());
+        }
+        meter.stop(victims.size());
+    }
+    meter.report("removeUser (2 channels)");
+}
+
+static void benchFraming(CommandHandler& handler, const std::vector<User*>& users, int rounds) {
+    User* user = users[0];
+    std::string traffic;
+    for (int i = 0; i < 16; ++i) {
+        traffic += "PRIVMSG user1 :the quick brown fox jumps over the lazy dog\r\n";
+        traffic += "PING :1234567890\r\n";
+    }
+    const size_t chunk = 1400;
+    ReadBuffer& input = user->getReadBuffer();
+    size_t lines_per_round = 32;
+
+    Meter meter;
+    for (int r = 0; r < rounds; r += lines_per_round) {
+        meter.start();
+        for (size_t offset = 0; offset < traffic.length(); ) {
+            offset += input.append(traffic.data() + offset, std::min(chunk, traffic.length() - offset));
+            const char* line;
+            size_t length;
+            while (input.nextLine(line, length) == ReadBuffer::LINE) {
+                handler.parseMessage(user, line, length);
+            }
+        }
+        meter.stop(lines_per_round);
+        drain(users);
+    }
+    meter.report("frame + dispatch per line");
+}
+
+int main(int argc, char* argv[]) {
+    int population = (argc > 1) ? std::atoi(argv[1]) : 10000;
+    int rounds = (argc > 2) ? std::atoi(argv[2]) : 200000;
+
+    raiseFdLimit();
+
+    Server server(0, "bench", 1, "", Server::NO_LISTENER);
+    server.setFloodLimits(100000, 100000);
+    CommandHandler handler(server);
+    std::vector<User*> users;
+    for (int i = 0; i < population; ++i) {
+        User* user = addUser(server, nickFor(i));
+        if (!user) {
+            break;
+        }
+        if (i < 10) {
+            join(server, user, "#m10");
+        }
+        if (i < 1000) {
+            join(server, user, "#m1000");
+        }
+        if (i < 10000) {
+            join(server, user, "#m10000");
+        }
+        users.push_back(user);
+    }
+    if (users.size() < 2) {
+        std::cerr << "Could not open enough descriptors" << std::endl;
+        return 1;
+    }
+    std::cout << users.size() << " users, " << rounds << " rounds" << std::endl;
+
+    // Warm the buffer pool and the queues before counting.
+    const char* warm = "PRIVMSG #m10 :warm";
+    for (int i = 0; i < 64; ++i) {
+        handler.parseMessage(users[0], warm, strlen(warm));
+    }
+    drain(users);
+
+    benchParse(rounds / 6);
+    benchDispatch(handler, users, rounds);
+    benchBroadcast(server, users, rounds);
+    benchLookup(server, users, rounds);
+    benchTeardown(server, rounds / 20);
+    benchFraming(handler, users, rounds);
+    return 0;
+}
@@ -0,0 +1,640 @@
+#include "LatencyHistogram.hpp"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Load generator for a running server: opens a few thousand nonblocking
+// clients, registers them and plays scripted scenarios against it.
+//
+//   connect  PASS/NICK/USER for every client, timed up to the 001
+//   join     every client joins its channel of --channel-size at once
+//   channel  PRIVMSG to those channels at --rate messages per second
+//   dm       PRIVMSG from each client to the next one, same pacing
+//   nick     clients change nickname, seen by every channel neighbour
+//   quit     every client QUITs at once, neighbours see each other go
+//
+// PRIVMSG and QUIT carry the send time in their text, so latency is
+// measured per delivered copy; JOIN, NICK and 001 are timed to the
+// sender's own echo. Fan-out counts every copy received. Scenarios that
+// send continuously need the server's --flood-rate to allow --rate spread
+// over --clients. --json prints one object per scenario for tracking.
+
+namespace {
+
+enum Phase { CONNECT, JOIN, CHANNEL, DM, NICK, QUIT, PHASES };
+
+const char* const PHASE_NAMES[PHASES] = { "connect", "join", "channel", "dm", "nick", "quit" };
+const char* const PHASE_COMMANDS[PHASES] = { "001", "JOIN", "PRIVMSG", "PRIVMSG", "NICK", "QUIT" };
+
+const int MAX_CONNECTING = 256;
+const int CONNECT_TIMEOUT_MS = 30000;
+const int DRAIN_TIMEOUT_MS = 5000;
+
+struct Client {
+    int fd;
+    int channel;
+    bool registered;
+    bool joined;
+    bool closed;
+    std::string nick;
+    std::string pending_nick;
+    std::string in;
+    std::string out;
+    unsigned long long sent_at;
+};
+
+struct Result {
+    unsigned long long sent;
+    unsigned long long delivered;
+    unsigned long long expected;
+    unsigned long long errors;
+    unsigned long long started;
+    unsigned long long send_done;
+    unsigned long long last_delivery;
+    LatencyHistogram latency;
+
+    Result() : sent(0), delivered(0), expected(0), errors(0), started(0), send_done(0), last_delivery(0) {}
+};
+
+struct Options {
+    std::string host;
+    int port;
+    std::string password;
+    int clients;
+    int channel_size;
+    int rate;
+    int duration;
+    size_t payload;
+    bool json;
+    bool selected[PHASES];
+};
+
+class Bench {
+private:
+    const Options& options;
+    std::vector<Client> clients;
+    std::vector<int> members;
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> polled;
+    struct sockaddr_in addr;
+    Phase phase;
+    Result* result;
+    size_t cursor;
+    int open_count;
+
+    void pump(int timeout_ms);
+    void flush(Client& client);
+    void send(Client& client, const std::string& line);
+    void readClient(Client& client);
+    void handleLine(Client& client, const std::string& line);
+    void markClosed(Client& client);
+    void deliver(unsigned long long sent_at);
+    std::string stamped() const;
+    bool issue(Client& client);
+    static std::string nickFor(size_t index, bool alternate);
+
+    void runConnect();
+    void runJoin();
+    void runPaced();
+    void runQuit();
+    void drain();
+
+public:
+    explicit Bench(const Options& options);
+
+    bool run(Phase phase, Result& result);
+    void report(Phase phase, const Result& result) const;
+    void closeAll();
+};
+
+Bench::Bench(const Options& options)
+    : options(options), clients(options.clients), phase(CONNECT), result(NULL), cursor(0), open_count(0) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+
+    int channel_count = (options.clients + options.channel_size - 1) / options.channel_size;
+    members.assign(channel_count, 0);
+    for (size_t i = 0; i < clients.size(); ++i) {
+        Client& client = clients[i];
+        client.fd = -1;
+        client.channel = static_cast<int>(i) / options.channel_size;
+        client.registered = false;
+        client.joined = false;
+        client.closed = false;
+        client.nick = nickFor(i, false);
+        client.sent_at = 0;
+    }
+}
+
+std::string Bench::nickFor(size_t index, bool alternate) {
+    std::ostringstream nick;
+    nick << (alternate ? 'n' : 'u') << index;
+    return nick.str();
+}
+
+std::string Bench::stamped() const {
+    std::ostringstream text;
+    text << "t=" << LatencyHistogram::now();
+    std::string payload = text.str();
+    if (payload.length() + 1 < options.payload) {
+        payload += ' ';
+        payload.append(options.payload - payload.length(), 'x');
+    }
+    return payload;
+}
+
+void Bench::flush(Client& client) {
+    while (!client.out.empty()) {
+        ssize_t n = ::send(client.fd, client.out.data(), client.out.length(), MSG_NOSIGNAL);
+        if (n > 0) {
+            client.out.erase(0, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN || errno == EINTR)) {
+            return;
+        }
+        markClosed(client);
+        return;
+    }
+}
+
+void Bench::send(Client& client, const std::string& line) {
+    if (client.closed) {
+        return;
+    }
+    client.out += line;
+    client.out += "\r\n";
+    flush(client);
+}
+
+void Bench::markClosed(Client& client) {
+    if (client.closed) {
+        return;
+    }
+    close(client.fd);
+    client.closed = true;
+    client.out.clear();
+    open_count--;
+    if (client.joined) {
+        members[client.channel]--;
+    }
+    if (phase != QUIT) {
+        result->errors++;
+    }
+}
+
+void Bench::deliver(unsigned long long sent_at) {
+    unsigned long long now = LatencyHistogram::now();
+    result->delivered++;
+    result->last_delivery = now;
+    if (sent_at != 0 && sent_at <= now) {
+        result->latency.record(now - sent_at);
+    }
+}
+
+void Bench::readClient(Client& client) {
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = read(client.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            client.in.append(buffer, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            break;
+        }
+        markClosed(client);
+        break;
+    }
+
+    size_t start = 0;
+    size_t end;
+    while ((end = client.in.find('\n', start)) != std::string::npos) {
+        size_t length = end - start;
+        if (length > 0 && client.in[end - 1] == '\r') {
+            length--;
+        }
+        handleLine(client, client.in.substr(start, length));
+        start = end + 1;
+    }
+    client.in.erase(0, start);
+}
+
+void Bench::handleLine(Client& client, const std::string& line) {
+    std::string source;
+    size_t pos = 0;
+    if (!line.empty() && line[0] == ':') {
+        pos = line.find(' ');
+        if (pos == std::string::npos) {
+            return;
+        }
+        source = line.substr(1, std::min(line.find('!'), pos) - 1);
+        pos++;
+    }
+    size_t space = line.find(' ', pos);
+    std::string command = line.substr(pos, space == std::string::npos ? std::string::npos : space - pos);
+
+    if (command == "PING") {
+        send(client, "PONG " + (space == std::string::npos ? std::string(":x") : line.substr(space + 1)));
+        return;
+    }
+    if (command.length() == 3 && (command[0] == '4' || command[0] == '5')) {
+        result->errors++;
+        return;
+    }
+    bool own = (command == "001") || source == client.nick;
+    if (command == "001") {
+        client.registered = true;
+    } else if (command == "JOIN" && source == client.nick) {
+        client.joined = true;
+        members[client.channel]++;
+    } else if (command == "NICK" && source == client.nick) {
+        client.nick = client.pending_nick;
+        client.pending_nick.clear();
+    }
+    if (command != PHASE_COMMANDS[phase]) {
+        return;
+    }
+
+    if (command == "PRIVMSG" || command == "QUIT") {
+        size_t stamp = line.find(" :t=");
+        deliver(stamp == std::string::npos ? 0 : std::strtoull(line.c_str() + stamp + 4, NULL, 10));
+    } else {
+        deliver(own ? client.sent_at : 0);
+    }
+}
+
+void Bench::pump(int timeout_ms) {
+    fds.clear();
+    polled.clear();
+    for (size_t i = 0; i < clients.size(); ++i) {
+        const Client& client = clients[i];
+        if (client.closed || client.fd < 0) {
+            continue;
+        }
+        struct pollfd entry;
+        entry.fd = client.fd;
+        entry.events = POLLIN | (client.out.empty() ? 0 : POLLOUT);
+        entry.revents = 0;
+        fds.push_back(entry);
+        polled.push_back(i);
+    }
+    if (fds.empty()) {
+        return;
+    }
+    if (poll(&fds[0], fds.size(), timeout_ms) < 0) {
+        return;
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+        Client& client = clients[polled[i]];
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            readClient(client);
+        }
+        if (!client.closed && (fds[i].revents & POLLOUT)) {
+            flush(client);
+        }
+    }
+}
+
+// Opens connections a window at a time so the listen backlog is not
+// overrun, and times each from connect() to the welcome numeric.
+void Bench::runConnect() {
+    size_t next = 0;
+    int connecting = 0;
+    unsigned long long deadline = LatencyHistogram::now() + CONNECT_TIMEOUT_MS * 1000000ULL;
+    while ((next < clients.size() || connecting > 0) && LatencyHistogram::now() < deadline) {
+        while (next < clients.size() && connecting < MAX_CONNECTING) {
+            Client& client = clients[next++];
+            client.fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (client.fd < 0) {
+                std::cerr << "socket: " << std::strerror(errno) << std::endl;
+                client.closed = true;
+                result->errors++;
+                continue;
+            }
+            fcntl(client.fd, F_SETFL, O_NONBLOCK);
+            open_count++;
+            client.sent_at = LatencyHistogram::now();
+            result->sent++;
+            if (connect(client.fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS) {
+                markClosed(client);
+                continue;
+            }
+            connecting++;
+            client.out = "PASS " + options.password + "\r\nNICK " + client.nick + "\r\nUSER "
+                + client.nick + " 0 * :ircbench\r\n";
+        }
+        pump(1);
+        connecting = 0;
+        for (size_t i = 0; i < next; ++i) {
+            if (!clients[i].closed && !clients[i].registered) {
+                connecting++;
+            }
+        }
+    }
+    result->expected = clients.size();
+    result->send_done = LatencyHistogram::now();
+}
+
+void Bench::runJoin() {
+    for (size_t i = 0; i < clients.size(); ++i) {
+        Client& client = clients[i];
+        if (client.closed) {
+            continue;
+        }
+        std::ostringstream line;
+        line << "JOIN #bench" << client.channel;
+        client.sent_at = LatencyHistogram::now();
+        send(client, line.str());
+        result->sent++;
+    }
+    // Each joiner is seen by itself and everyone who joined before it.
+    std::vector<unsigned long long> joiners(members.size(), 0);
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (!clients[i].closed) {
+            joiners[clients[i].channel]++;
+        }
+    }
+    for (size_t i = 0; i < joiners.size(); ++i) {
+        result->expected += joiners[i] * (joiners[i] + 1) / 2;
+    }
+    result->send_done = LatencyHistogram::now();
+    drain();
+}
+
+bool Bench::issue(Client& client) {
+    size_t index = &client - &clients[0];
+    if (phase == CHANNEL) {
+        if (!client.joined || members[client.channel] < 2) {
+            return false;
+        }
+        std::ostringstream line;
+        line << "PRIVMSG #bench" << client.channel << " :" << stamped();
+        send(client, line.str());
+        result->expected += members[client.channel] - 1;
+    } else if (phase == DM) {
+        const Client& target = clients[(index + 1) % clients.size()];
+        if (&target == &client || target.closed || !target.pending_nick.empty()) {
+            return false;
+        }
+        send(client, "PRIVMSG " + target.nick + " :" + stamped());
+        result->expected++;
+    } else {
+        if (!client.pending_nick.empty() || !client.joined) {
+            return false;
+        }
+        client.pending_nick = nickFor(index, client.nick[0] == 'u');
+        client.sent_at = LatencyHistogram::now();
+        send(client, "NICK " + client.pending_nick);
+        result->expected += members[client.channel];
+    }
+    result->sent++;
+    return true;
+}
+
+// Spreads --rate messages per second round-robin over the clients for
+// --duration seconds, skipping any that cannot send right now.
+void Bench::runPaced() {
+    unsigned long long end = result->started + options.duration * 1000000000ULL;
+    unsigned long long now;
+    while ((now = LatencyHistogram::now()) < end) {
+        unsigned long long due = (now - result->started) / 1000 * options.rate / 1000000;
+        size_t tried = 0;
+        while (result->sent < due && tried < clients.size()) {
+            Client& client = clients[cursor];
+            cursor = (cursor + 1) % clients.size();
+            tried++;
+            if (!client.closed && client.registered) {
+                issue(client);
+            }
+        }
+        pump(1);
+    }
+    result->send_done = LatencyHistogram::now();
+    drain();
+}
+
+void Bench::runQuit() {
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (!clients[i].closed) {
+            send(clients[i], "QUIT :" + stamped());
+            result->sent++;
+        }
+    }
+    result->send_done = LatencyHistogram::now();
+    unsigned long long deadline = result->send_done + DRAIN_TIMEOUT_MS * 1000000ULL;
+    while (open_count > 0 && LatencyHistogram::now() < deadline) {
+        pump(10);
+    }
+    result->last_delivery = LatencyHistogram::now();
+    result->errors += open_count;
+}
+
+// Keeps reading until every expected copy has arrived, or nothing has
+// for DRAIN_TIMEOUT_MS.
+void Bench::drain() {
+    unsigned long long idle_since = LatencyHistogram::now();
+    unsigned long long seen = result->delivered;
+    while (result->delivered < result->expected) {
+        pump(10);
+        unsigned long long now = LatencyHistogram::now();
+        if (result->delivered != seen) {
+            seen = result->delivered;
+            idle_since = now;
+        } else if (now - idle_since > DRAIN_TIMEOUT_MS * 1000000ULL) {
+            break;
+        }
+    }
+}
+
+bool Bench::run(Phase next, Result& out) {
+    phase = next;
+    result = &out;
+    out.started = LatencyHistogram::now();
+    switch (phase) {
+        case CONNECT: runConnect(); break;
+        case JOIN: runJoin(); break;
+        case QUIT: runQuit(); break;
+        default: runPaced(); break;
+    }
+    if (out.last_delivery < out.send_done) {
+        out.last_delivery = out.send_done;
+    }
+    return open_count > 0;
+}
+
+void Bench::closeAll() {
+    phase = QUIT;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (!clients[i].closed && clients[i].fd >= 0) {
+            markClosed(clients[i]);
+        }
+    }
+}
+
+void Bench::report(Phase which, const Result& out) const {
+    double send_seconds = (out.send_done - out.started) / 1e9;
+    double seconds = (out.last_delivery - out.started) / 1e9;
+    bool burst = (which == CONNECT || which == JOIN || which == QUIT);
+    double msgs_per_sec = out.sent / (burst ? seconds : send_seconds);
+    double fanout_per_sec = out.delivered / seconds;
+    unsigned long long lost = (out.expected > out.delivered) ? out.expected - out.delivered : 0;
+    if (which == QUIT) {
+        lost = 0;
+    }
+    const LatencyHistogram& h = out.latency;
+
+    if (options.json) {
+        std::cout << std::fixed << std::setprecision(1)
+                  << "{\"scenario\":\"" << PHASE_NAMES[which] << "\",\"clients\":" << options.clients
+                  << ",\"channel_size\":" << options.channel_size << ",\"rate\":" << options.rate
+                  << ",\"sent\":" << out.sent << ",\"delivered\":" << out.delivered
+                  << ",\"lost\":" << lost << ",\"errors\":" << out.errors
+                  << ",\"seconds\":" << std::setprecision(3) << seconds << std::setprecision(1)
+                  << ",\"msgs_per_sec\":" << msgs_per_sec << ",\"fanout_per_sec\":" << fanout_per_sec
+                  << ",\"p50_us\":" << h.percentile(0.50) / 1e3 << ",\"p99_us\":" << h.percentile(0.99) / 1e3
+                  << ",\"p999_us\":" << h.percentile(0.999) / 1e3 << ",\"max_us\":" << h.getMax() / 1e3
+                  << "}" << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(9) << PHASE_NAMES[which] << std::right
+              << std::setw(9) << out.sent << std::setw(11) << out.delivered
+              << std::setw(7) << lost << std::setw(7) << out.errors
+              << std::fixed << std::setprecision(2) << std::setw(8) << seconds
+              << std::setprecision(0) << std::setw(10) << msgs_per_sec << std::setw(11) << fanout_per_sec
+              << std::setprecision(1) << std::setw(10) << h.percentile(0.50) / 1e3
+              << std::setw(10) << h.percentile(0.99) / 1e3 << std::setw(10) << h.percentile(0.999) / 1e3
+              << std::setw(10) << h.getMax() / 1e3 << std::endl;
+}
+
+bool parseScenarios(const std::string& list, bool* selected) {
+    for (int i = 0; i < PHASES; ++i) {
+        selected[i] = false;
+    }
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        int i = 0;
+        while (i < PHASES && name != PHASE_NAMES[i]) {
+            ++i;
+        }
+        if (name == "all") {
+            for (i = 0; i < PHASES; ++i) {
+                selected[i] = true;
+            }
+        } else if (i == PHASES) {
+            return false;
+        } else {
+            selected[i] = true;
+        }
+    }
+    return true;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " <port> <password> [--host ADDR] [--clients N] [--channel-size N]"
+              << " [--rate N] [--duration S] [--payload BYTES] [--scenarios LIST] [--json]" << std::endl
+              << "Scenarios: connect,join,channel,dm,nick,quit or all (default)" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    Options options;
+    options.host = "127.0.0.1";
+    options.port = std::atoi(argv[1]);
+    options.password = argv[2];
+    options.clients = 1000;
+    options.channel_size = 200;
+    options.rate = 1000;
+    options.duration = 5;
+    options.payload = 64;
+    options.json = false;
+    parseScenarios("all", options.selected);
+
+    for (int i = 3; i < argc; ++i) {
+        std::string option = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (option == "--json") {
+            options.json = true;
+        } else if (option == "--host" && has_value) {
+            options.host = argv[++i];
+        } else if (option == "--clients" && has_value) {
+            options.clients = std::atoi(argv[++i]);
+        } else if (option == "--channel-size" && has_value) {
+            options.channel_size = std::atoi(argv[++i]);
+        } else if (option == "--rate" && has_value) {
+            options.rate = std::atoi(argv[++i]);
+        } else if (option == "--duration" && has_value) {
+            options.duration = std::atoi(argv[++i]);
+        } else if (option == "--payload" && has_value) {
+            options.payload = std::atoi(argv[++i]);
+        } else if (option == "--scenarios" && has_value) {
+            if (!parseScenarios(argv[++i], options.selected)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    struct in_addr probe;
+    if (options.port <= 0 || options.clients < 1 || options.clients > 99999 || options.channel_size < 1
+        || options.rate < 1 || options.duration < 1 || inet_pton(AF_INET, options.host.c_str(), &probe) != 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < static_cast<rlim_t>(options.clients) + 16) {
+        limit.rlim_cur = std::min(limit.rlim_max, static_cast<rlim_t>(options.clients) + 16);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (!options.json) {
+        std::cout << options.clients << " clients, channels of " << options.channel_size << ", "
+                  << options.rate << " msgs/s for " << options.duration << " s, latency in us" << std::endl
+                  << "scenario      sent  delivered   lost   errs    secs    msgs/s   fanout/s"
+                  << "       p50       p99     p99.9       max" << std::endl;
+    }
+
+    // connect and join set up the others, so they always run; they are
+    // only reported when asked for.
+    Bench bench(options);
+    for (int phase = CONNECT; phase < PHASES; ++phase) {
+        if (phase > JOIN && !options.selected[phase]) {
+            continue;
+        }
+        Result result;
+        bool alive = bench.run(static_cast<Phase>(phase), result);
+        if (phase <= JOIN && !options.selected[phase]) {
+            continue;
+        }
+        bench.report(static_cast<Phase>(phase), result);
+        if (!alive) {
+            break;
+        }
+    }
+    bench.closeAll();
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// PING round trips of light clients while one heavy client pipelines
+// channel messages to a room of sinks as fast as the server takes them.
+// Run against a server started with a flood limit high enough to let the
+// heavy client through, e.g. --flood-rate 100000 --flood-burst 100000.
+
+static double nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connectClient(int port, const std::string& password, const std::string& nick, const char* channel) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    std::string hello = "PASS " + password + "\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :bench\r\n";
+    if (channel) {
+        hello += std::string("JOIN ") + channel + "\r\n";
+    }
+    std::string seen;
+    char buffer[4096];
+    if (send(fd, hello.data(), hello.length(), MSG_NOSIGNAL) < 0) {
+        close(fd);
+        return -1;
+    }
+    while (seen.find(channel ? " 366 " : " 001 ") == std::string::npos) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        seen.append(buffer, n);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static void discard(int fd) {
+    char buffer[65536];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <port> [password] [light] [sinks] [seconds]" << std::endl;
+        return 1;
+    }
+    int port = std::atoi(argv[1]);
+    std::string password = (argc > 2) ? argv[2] : "pw";
+    int light_count = (argc > 3) ? std::atoi(argv[3]) : 8;
+    int sink_count = (argc > 4) ? std::atoi(argv[4]) : 20;
+    int seconds = (argc > 5) ? std::atoi(argv[5]) : 5;
+
+    int heavy = connectClient(port, password, "heavy", "#flood");
+    std::vector<int> sinks;
+    for (int i = 0; i < sink_count; ++i) {
+        std::ostringstream nick;
+        nick << "sink" << i;
+        sinks.push_back(connectClient(port, password, nick.str(), "#flood"));
+    }
+    std::vector<int> lights;
+    for (int i = 0; i < light_count; ++i) {
+        std::ostringstream nick;
+        nick << "light" << i;
+        lights.push_back(connectClient(port, password, nick.str(), NULL));
+    }
+    if (heavy < 0 || std::find(sinks.begin(), sinks.end(), -1) != sinks.end()
+        || std::find(lights.begin(), lights.end(), -1) != lights.end()) {
+        std::cerr << "Could not connect and register all clients" << std::endl;
+        return 1;
+    }
+
+    std::string block;
+    for (int i = 0; i < 512; ++i) {
+        block += "PRIVMSG #flood :heavy traffic from one client\r\n";
+    }
+    size_t block_offset = 0;
+    unsigned long long heavy_bytes = 0;
+
+    std::vector<double> sent_at(light_count, 0);
+    std::vector<double> next_at(light_count, 0);
+    std::vector<double> samples;
+
+    std::vector<struct pollfd> fds;
+    double end = nowUs() + seconds * 1e6;
+    while (nowUs() < end) {
+        double now = nowUs();
+        for (int i = 0; i < light_count; ++i) {
+            if (sent_at[i] == 0 && now >= next_at[i]) {
+                if (send(lights[i], "PING :latency\r\n", 15, MSG_NOSIGNAL) == 15) {
+                    sent_at[i] = now;
+                }
+            }
+        }
+
+        fds.clear();
+        struct pollfd entry;
+        entry.fd = heavy;
+        entry.events = POLLIN | POLLOUT;
+        fds.push_back(entry);
+        entry.events = POLLIN;
+        for (size_t i = 0; i < sinks.size(); ++i) {
+            entry.fd = sinks[i];
+            fds.push_back(entry);
+        }
+        for (size_t i = 0; i < lights.size(); ++i) {
+            entry.fd = lights[i];
+            fds.push_back(entry);
+        }
+        if (poll(&fds[0], fds.size(), 1) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (fds[0].revents & POLLOUT) {
+            ssize_t n = send(heavy, block.data() + block_offset, block.length() - block_offset, MSG_NOSIGNAL);
+            if (n > 0) {
+                heavy_bytes += n;
+                block_offset = (block_offset + n) % block.length();
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            discard(heavy);
+        }
+        for (size_t i = 0; i < sinks.size(); ++i) {
+            if (fds[1 + i].revents & POLLIN) {
+                discard(sinks[i]);
+            }
+        }
+        for (int i = 0; i < light_count; ++i) {
+            if (!(fds[1 + sinks.size() + i].revents & POLLIN)) {
+                continue;
+            }
+            char buffer[4096];
+            ssize_t n = read(lights[i], buffer, sizeof(buffer));
+            if (n > 0 && sent_at[i] != 0 && std::string(buffer, n).find("PONG") != std::string::npos) {
+                double done = nowUs();
+                samples.push_back(done - sent_at[i]);
+                sent_at[i] = 0;
+                next_at[i] = done + 2000;
+            }
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    std::cout << "heavy client pushed " << heavy_bytes / 1024 << " KiB to " << sink_count << " sinks" << std::endl;
+    if (samples.empty()) {
+        std::cout << "no PING replies" << std::endl;
+        return 1;
+    }
+    std::cout << samples.size() << " light PINGs   p50 " << std::fixed << std::setprecision(0)
+              << samples[samples.size() / 2] << " us   p99 " << samples[samples.size() * 99 / 100]
+              << " us   max " << samples.back() << " us" << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "Server.hpp"
+#include "CommandHandler.hpp"
+#include "CasemapTable.hpp"
+#include "BenchSupport.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+
+// PRIVMSG to a nick against a large population of connected nicks. First
+// the target lookup on its own, the old linear scan over every user
+// versus the casemapped index; then whole PRIVMSG commands dispatched to
+// registered users on /dev/null, parsed arguments to queued line.
+
+static std::string nickFor(size_t index) {
+    std::ostringstream nick;
+    nick << "User" << index;
+    return nick.str();
+}
+
+static void report(const char* name, size_t population, int count, const char* unit, double elapsed) {
+    std::cout << std::left << std::setw(14) << name << std::right
+              << std::setw(8) << population << " nicks  "
+              << std::fixed << std::setprecision(0) << std::setw(12)
+              << count / (elapsed / 1e9) << ' ' << unit << "/s  "
+              << std::setprecision(1) << std::setw(10) << elapsed / count << " ns/" << unit << std::endl;
+}
+
+static void benchLookup(int population, int lookups, const std::vector<size_t>& picks) {
+    std::vector<User*> users;
+    CasemapTable<User*> nicks;
+    for (int i = 0; i < population; ++i) {
+        User* user = new User(-1);
+        user->setNickname(nickFor(i));
+        users.push_back(user);
+        nicks.insert(user->getNickname(), user);
+    }
+    std::vector<std::string> targets;
+    for (size_t i = 0; i < picks.size(); ++i) {
+        targets.push_back(nickFor(picks[i] % population));
+    }
+
+    int scan_lookups = lookups / 1000 > 0 ? lookups / 1000 : 1;
+    size_t found = 0;
+    double start = nowNs();
+    for (int i = 0; i < scan_lookups; ++i) {
+        const std::string& target = targets[i % targets.size()];
+        for (std::vector<User*>::const_iterator it = users.begin(); it != users.end(); ++it) {
+            if ((*it)->getNickname() == target) {
+                found++;
+                break;
+            }
+        }
+    }
+    report("scan", users.size(), scan_lookups, "lookup", nowNs() - start);
+
+    start = nowNs();
+    for (int i = 0; i < lookups; ++i) {
+        if (nicks.find(targets[i % targets.size()])) {
+            found++;
+        }
+    }
+    report("index", users.size(), lookups, "lookup", nowNs() - start);
+
+    if (found == 0) {
+        std::cout << "no nick found" << std::endl;
+    }
+    for (size_t i = 0; i < users.size(); ++i) {
+        delete users[i];
+    }
+}
+
+// Registers sink users without the handshake until the population is
+// reached or descriptors run out, then sends PRIVMSG to random nicks.
+// Each batch's target queues are emptied outside the timed region.
+static void benchPrivmsg(int population, int messages, const std::vector<size_t>& picks) {
+    Server server(0, "bench", 1, "", Server::NO_LISTENER);
+    CommandHandler handler(server);
+    std::vector<User*> users;
+    for (int i = 0; i < population; ++i) {
+        int fd = openSink();
+        if (fd < 0) {
+            break;
+        }
+        server.addUser(fd);
+        User* user = server.getUser(fd);
+        user->setAuthenticated(true);
+        user->setUsername(nickFor(i));
+        server.setNickname(user, nickFor(i));
+        user->setRegistered(true);
+        users.push_back(user);
+    }
+    if (users.size() < 2) {
+        std::cerr << "Could not open enough descriptors" << std::endl;
+        return;
+    }
+    if (users.size() < static_cast<size_t>(population)) {
+        std::cout << "descriptor limit: " << users.size() << " of " << population << " users registered" << std::endl;
+    }
+
+    const int batch = 64;
+    std::vector<std::vector<std::string> > args;
+    for (size_t i = 0; i < picks.size(); ++i) {
+        std::vector<std::string> message;
+        message.push_back(nickFor(picks[i] % users.size()));
+        message.push_back(":the quick brown fox jumps over the lazy dog");
+        args.push_back(message);
+    }
+    User* sender = users[0];
+    double elapsed = 0;
+    for (int sent = 0; sent < messages; sent += batch) {
+        double start = nowNs();
+        for (int i = 0; i < batch; ++i) {
+            handler.executeCommand(sender, "PRIVMSG", args[(sent + i) % args.size()]);
+        }
+        elapsed += nowNs() - start;
+        for (int i = 0; i < batch; ++i) {
+            OutputQueue& queue = users[picks[(sent + i) % picks.size()] % users.size()]->getSendQueue();
+            queue.consume(queue.byteCount());
+        }
+        OutputQueue& own = sender->getSendQueue();
+        own.consume(own.byteCount());
+    }
+    report("PRIVMSG nick", users.size(), (messages + batch - 1) / batch * batch, "PRIVMSG", elapsed);
+}
+
+int main(int argc, char* argv[]) {
+    int population = (argc > 1) ? std::atoi(argv[1]) : 100000;
+    int messages = (argc > 2) ? std::atoi(argv[2]) : 200000;
+    if (population < 2 || messages < 1) {
+        std::cerr << "usage: nick_bench [population >= 2] [messages]" << std::endl;
+        return 1;
+    }
+
+    raiseFdLimit();
+    std::vector<size_t> picks;
+    std::srand(42);
+    for (int i = 0; i < 1024; ++i) {
+        picks.push_back(std::rand());
+    }
+
+    benchLookup(population, messages, picks);
+    benchPrivmsg(population, messages, picks);
+    return 0;
+}
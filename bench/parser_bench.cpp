@@ -0,0 +1,201 @@
+#include "IrcMessage.hpp"
+#include "BenchSupport.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <cctype>
+
+// Checks IrcMessage::parse against the istringstream splitter it replaced,
+// using bench/parser_corpus.txt, then times both on a traffic-like mix.
+
+// The former CommandHandler::splitMessage, plus the command uppercasing
+// parseMessage did before dispatch.
+static std::vector<std::string> legacySplit(const std::string& message) {
+    std::vector<std::string> result;
+    std::istringstream iss(message);
+    std::string token;
+    bool found_colon = false;
+    while (!found_colon && iss >> token) {
+        if (token[0] == ':') {
+            found_colon = true;
+            std::string trailing = token;
+            std::string rest;
+            std::getline(iss, rest);
+            if (!rest.empty()) {
+                trailing += rest;
+            }
+            result.push_back(trailing);
+            break;
+        } else {
+            result.push_back(token);
+        }
+    }
+    if (!found_colon && !token.empty() && token[0] == ':') {
+        result.push_back(token);
+    }
+    if (!result.empty()) {
+        for (std::string::iterator it = result[0].begin(); it != result[0].end(); ++it) {
+            *it = toupper(*it);
+        }
+    }
+    return result;
+}
+
+static std::vector<std::string> parseTokens(const std::string& line) {
+    std::vector<std::string> tokens;
+    IrcMessage message;
+    if (!IrcMessage::parse(line.data(), line.length(), message)) {
+        return tokens;
+    }
+
+    std::vector<std::string> params;
+    message.copyParams(params);
+    tokens.push_back(message.command.str());
+    for (std::string::iterator it = tokens[0].begin(); it != tokens[0].end(); ++it) {
+        *it = toupper(*it);
+    }
+    tokens.insert(tokens.end(), params.begin(), params.end());
+    return tokens;
+}
+
+static std::string stripSource(const std::string& line) {
+    size_t pos = line.find_first_not_of(' ');
+    for (int i = 0; i < 2 && pos != std::string::npos; ++i) {
+        if (line[pos] != (i == 0 ? '@' : ':')) {
+            continue;
+        }
+        pos = line.find(' ', pos);
+        if (pos != std::string::npos) {
+            pos = line.find_first_not_of(' ', pos);
+        }
+    }
+    return (pos == std::string::npos) ? "" : line.substr(pos);
+}
+
+static std::vector<std::string> splitExpected(const std::string& text) {
+    std::vector<std::string> tokens;
+    if (text.empty()) {
+        return tokens;
+    }
+    size_t start = 0;
+    size_t bar;
+    while ((bar = text.find('|', start)) != std::string::npos) {
+        tokens.push_back(text.substr(start, bar - start));
+        start = bar + 1;
+    }
+    tokens.push_back(text.substr(start));
+    return tokens;
+}
+
+static std::string join(const std::vector<std::string>& tokens) {
+    std::string out = "[";
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        out += (i ? "|" : "") + tokens[i];
+    }
+    return out + "]";
+}
+
+static int checkCorpus(const char* path, std::vector<std::string>& lines) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "cannot open " << path << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    int checked = 0;
+    std::string entry;
+    while (std::getline(file, entry)) {
+        if (entry.empty() || entry[0] == '#') {
+            continue;
+        }
+
+        std::string line = entry;
+        std::vector<std::string> expected;
+        size_t arrow = entry.find(" => ");
+        if (arrow == std::string::npos && entry.length() >= 3 && entry.compare(entry.length() - 3, 3, " =>") == 0) {
+            arrow = entry.length() - 3;
+        }
+        if (arrow != std::string::npos) {
+            line = entry.substr(0, arrow);
+            expected = splitExpected(entry.substr(std::min(arrow + 4, entry.length())));
+        } else {
+            expected = legacySplit(stripSource(line));
+            lines.push_back(line);
+        }
+
+        std::vector<std::string> actual = parseTokens(line);
+        checked++;
+        if (actual != expected) {
+            failures++;
+            std::cout << "MISMATCH: " << line << std::endl
+                      << "  expected " << join(expected) << std::endl
+                      << "  got      " << join(actual) << std::endl;
+        }
+    }
+    std::cout << "conformance: " << checked - failures << "/" << checked << " lines match" << std::endl;
+    return failures ? 1 : 0;
+}
+
+static void report(const char* name, size_t lines, size_t allocations, double elapsed) {
+    std::cout << std::left << std::setw(20) << name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(8) << elapsed / lines << " ns/line  "
+              << std::setprecision(2) << std::setw(6) << static_cast<double>(allocations) / lines << " allocs/line" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    const char* corpus = (argc > 1) ? argv[1] : "bench/parser_corpus.txt";
+    int rounds = (argc > 2) ? std::atoi(argv[2]) : 20000;
+
+    std::vector<std::string> lines;
+    int status = checkCorpus(corpus, lines);
+
+    lines.push_back("PRIVMSG #general :hey, has anyone looked at the build failure from this morning?");
+    lines.push_back("PRIVMSG #general :hey, has anyone looked at the build failure from this morning?");
+    lines.push_back("PRIVMSG bob :lunch?");
+    lines.push_back("PING :irc.example.net");
+    size_t total = lines.size() * rounds;
+
+    size_t before = allocation_count;
+    double start = nowNs();
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < lines.size(); ++i) {
+            std::vector<std::string> parts = legacySplit(lines[i]);
+            if (!parts.empty()) {
+                parts.erase(parts.begin());
+            }
+        }
+    }
+    report("istringstream", total, allocation_count - before, nowNs() - start);
+
+    IrcMessage message;
+    size_t params = 0;
+    before = allocation_count;
+    start = nowNs();
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < lines.size(); ++i) {
+            IrcMessage::parse(lines[i].data(), lines[i].length(), message);
+            params += message.paramCount;
+        }
+    }
+    report("IrcMessage::parse", total, allocation_count - before, nowNs() - start);
+
+    std::string command;
+    std::vector<std::string> args;
+    before = allocation_count;
+    start = nowNs();
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < lines.size(); ++i) {
+            if (IrcMessage::parse(lines[i].data(), lines[i].length(), message)) {
+                command.assign(message.command.data, message.command.length);
+                message.copyParams(args);
+            }
+        }
+    }
+    report("parse + copyParams", total, allocation_count - before, nowNs() - start);
+
+    return (params > 0) ? status : 1;
+}
@@ -0,0 +1,93 @@
+#include "Poller.hpp"
+#include "UringPoller.hpp"
+#include "BenchSupport.hpp"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+
+// Measures the cost of one wakeup of each poller while N idle
+// descriptors are registered and a single socketpair carries traffic.
+
+static void benchPoller(Poller* poller, int idle, int iterations) {
+    std::vector<int> idle_fds;
+    int pair[2] = { -1, -1 };
+
+    for (int i = 0; i < idle; ++i) {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            break;
+        }
+        idle_fds.push_back(fd);
+        poller->add(fd, Poller::READ, true);
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0) {
+        poller->add(pair[1], Poller::READ, false);
+
+        std::vector<Poller::Event> events;
+        char byte = 'x';
+        double start = nowNs();
+        for (int i = 0; i < iterations; ++i) {
+            if (write(pair[0], &byte, 1) != 1) {
+                break;
+            }
+            poller->wait(events, 1000);
+            if (read(pair[1], &byte, 1) != 1) {
+                break;
+            }
+        }
+        double elapsed = nowNs() - start;
+
+        std::cout << std::left << std::setw(10) << poller->getName()
+                  << std::right << std::setw(8) << idle_fds.size() << " idle  "
+                  << std::fixed << std::setprecision(1) << std::setw(10)
+                  << elapsed / iterations << " ns/wakeup" << std::endl;
+
+        poller->remove(pair[1]);
+        close(pair[0]);
+        close(pair[1]);
+    }
+
+    for (size_t i = 0; i < idle_fds.size(); ++i) {
+        poller->remove(idle_fds[i]);
+        close(idle_fds[i]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = (argc > 1) ? std::atoi(argv[1]) : 20000;
+    int limit = raiseFdLimit();
+    const int sizes[] = { 1000, 10000, 50000 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        int idle = sizes[i];
+        if (idle + 16 > limit) {
+            std::cout << "skipping " << idle << " idle: RLIMIT_NOFILE is " << limit << std::endl;
+            continue;
+        }
+
+#ifndef IRC_USE_SELECT
+        EpollPoller epoll_poller;
+        benchPoller(&epoll_poller, idle, iterations);
+#endif
+#ifdef IRC_HAVE_IO_URING
+        try {
+            UringPoller uring_poller;
+            benchPoller(&uring_poller, idle, iterations);
+        } catch (const std::exception& e) {
+            std::cout << "io_uring unavailable: " << e.what() << std::endl;
+        }
+#endif
+        if (idle + 16 < FD_SETSIZE) {
+            SelectPoller select_poller;
+            benchPoller(&select_poller, idle, iterations);
+        } else {
+            std::cout << "select    " << std::setw(8) << idle << " idle  unsupported (FD_SETSIZE "
+                      << FD_SETSIZE << ")" << std::endl;
+        }
+    }
+    return 0;
+}
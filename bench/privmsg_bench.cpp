@@ -0,0 +1,110 @@
+#include "Server.hpp"
+#include "CommandHandler.hpp"
+#include "BenchSupport.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+// Allocations and time per channel PRIVMSG: the former concatenating
+// handler against the real handler, dispatched from pre-split arguments,
+// with cached prefixes, pooled line buffers and ring output queues.
+
+// The former handlePrivmsg channel path, minus the lookups.
+static void legacyPrivmsg(User* user, Channel* channel, const std::vector<std::string>& args, Server& server) {
+    std::string target = args[0];
+    std::string message;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (i > 1) message += " ";
+        message += args[i];
+    }
+    if (!message.empty() && message[0] == ':') {
+        message = message.substr(1);
+    }
+    std::string msg = ":" + user->getNickname() + "!~" + user->getUsername() + "@localhost PRIVMSG " + target + " :" + message;
+    channel->broadcast(user->getFd(), msg, &server);
+}
+
+static void drain(const std::vector<User*>& users) {
+    for (size_t i = 0; i < users.size(); ++i) {
+        OutputQueue& queue = users[i]->getSendQueue();
+        queue.consume(queue.byteCount());
+    }
+}
+
+static void report(const char* name, int messages, size_t allocations, double elapsed) {
+    std::cout << std::left << std::setw(10) << name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(8)
+              << static_cast<double>(allocations) / messages << " allocs/msg  "
+              << std::setprecision(0) << std::setw(8)
+              << elapsed / messages << " ns/msg" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int members = (argc > 1) ? std::atoi(argv[1]) : 50;
+    int messages = (argc > 2) ? std::atoi(argv[2]) : 200000;
+    const int batch = 64;
+    messages = (messages + batch - 1) / batch * batch;
+
+    Server server(0, "bench", 1, "", Server::NO_LISTENER);
+    CommandHandler handler(server);
+    std::vector<User*> users;
+    for (int i = 0; i < members; ++i) {
+        int fd = openSink();
+        if (fd < 0) {
+            break;
+        }
+        server.addUser(fd);
+        User* user = server.getUser(fd);
+        std::ostringstream nick;
+        nick << "user" << i;
+        std::string lines[] = {
+            "PASS bench",
+            "NICK " + nick.str(),
+            "USER " + nick.str() + " 0 * :Bench User",
+            "JOIN #bench"
+        };
+        for (size_t j = 0; j < sizeof(lines) / sizeof(lines[0]); ++j) {
+            handler.parseMessage(user, lines[j].data(), lines[j].length());
+        }
+        users.push_back(user);
+    }
+    drain(users);
+
+    User* sender = users[0];
+    Channel* channel = server.getChannel("#bench");
+    const char* text = "PRIVMSG #bench :the quick brown fox jumps over the lazy dog";
+    std::vector<std::string> args;
+    args.push_back("#bench");
+    args.push_back(":the quick brown fox jumps over the lazy dog");
+    std::cout << users.size() << " members, " << messages << " messages" << std::endl;
+
+    // Warm the deques and the buffer pool before counting.
+    for (int i = 0; i < batch; ++i) {
+        handler.parseMessage(sender, text, strlen(text));
+    }
+    drain(users);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t allocations = 0;
+        double elapsed = 0;
+        for (int sent = 0; sent < messages; sent += batch) {
+            size_t before = allocation_count;
+            double start = nowNs();
+            for (int i = 0; i < batch; ++i) {
+                if (pass == 0) {
+                    legacyPrivmsg(sender, channel, args, server);
+                } else {
+                    handler.executeCommand(sender, "PRIVMSG", args);
+                }
+            }
+            elapsed += nowNs() - start;
+            allocations += allocation_count - before;
+            drain(users);
+        }
+        report(pass == 0 ? "concat" : "dispatch", messages, allocations, elapsed);
+    }
+    return 0;
+}
@@ -10,8 +10,19 @@ void signalHandler(int signum) {
     }
 }
 
+void reportHandler(int signum) {
+    (void)signum;
+    if (g_server) {
+        g_server->requestReport();
+    }
+}
+
 void printUsage(const char* programName) {
-    std::cout << "Usage: " << programName << " <port> <password>" << std::endl;
+    std::cout << "Usage: " << programName << " <port> <password> [--threads N] [--io epoll|select|uring] [--accept-batch N]"
+              << " [--register-timeout S] [--ping-interval S] [--pong-timeout S]"
+              << " [--sendq-soft KB] [--sendq-hard KB] [--sendq-budget MB]"
+              << " [--flood-rate N] [--flood-burst N] [--oper-password PASS] [--metrics-port N]"
+              << " [--log-level debug|info|warn|error]" << std::endl;
     std::cout << "Example: " << programName << " 6667 password123" << std::endl;
 }
 
@@ -29,7 +40,7 @@ bool isNumeric(const char* str) {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
+    if (argc < 3) {
         printUsage(argv[0]);
         return 1;
     }
@@ -45,15 +56,97 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    int threads = 1;
+    int accept_batch = 64;
+    int timeouts[3] = { 60, 120, 60 };
+    const char* timeout_options[3] = { "--register-timeout", "--ping-interval", "--pong-timeout" };
+    int sendq[3] = { 256, 1024, 512 };
+    const char* sendq_options[3] = { "--sendq-soft", "--sendq-hard", "--sendq-budget" };
+    int flood[2] = { 4, 20 };
+    int metrics_port = 0;
+    std::string oper_password;
+    std::string backend;
+    for (int i = 3; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--threads" && i + 1 < argc && isNumeric(argv[i + 1])) {
+            threads = std::atoi(argv[++i]);
+            if (threads < 1 || threads > 256) {
+                std::cout << "Error: Thread count must be between 1 and 256." << std::endl;
+                return 1;
+            }
+        } else if (option == "--accept-batch" && i + 1 < argc && isNumeric(argv[i + 1])) {
+            accept_batch = std::atoi(argv[++i]);
+            if (accept_batch < 1 || accept_batch > 65536) {
+                std::cout << "Error: Accept batch must be between 1 and 65536." << std::endl;
+                return 1;
+            }
+        } else if (i + 1 < argc && isNumeric(argv[i + 1])
+                   && (option == timeout_options[0] || option == timeout_options[1] || option == timeout_options[2])) {
+            int index = (option == timeout_options[0]) ? 0 : (option == timeout_options[1]) ? 1 : 2;
+            timeouts[index] = std::atoi(argv[++i]);
+            if (timeouts[index] < 1 || timeouts[index] > 86400) {
+                std::cout << "Error: Timeouts must be between 1 and 86400 seconds." << std::endl;
+                return 1;
+            }
+        } else if (i + 1 < argc && isNumeric(argv[i + 1])
+                   && (option == sendq_options[0] || option == sendq_options[1] || option == sendq_options[2])) {
+            int index = (option == sendq_options[0]) ? 0 : (option == sendq_options[1]) ? 1 : 2;
+            sendq[index] = std::atoi(argv[++i]);
+            if (sendq[index] < 1 || sendq[index] > 1048576) {
+                std::cout << "Error: SendQ limits must be between 1 and 1048576." << std::endl;
+                return 1;
+            }
+        } else if ((option == "--flood-rate" || option == "--flood-burst") && i + 1 < argc && isNumeric(argv[i + 1])) {
+            int index = (option == "--flood-rate") ? 0 : 1;
+            flood[index] = std::atoi(argv[++i]);
+            if (flood[index] < 1 || flood[index] > 100000) {
+                std::cout << "Error: Flood limits must be between 1 and 100000." << std::endl;
+                return 1;
+            }
+        } else if (option == "--metrics-port" && i + 1 < argc && isNumeric(argv[i + 1])) {
+            metrics_port = std::atoi(argv[++i]);
+            if (metrics_port <= 0 || metrics_port > 65535 || metrics_port == port) {
+                std::cout << "Error: Metrics port must be between 1 and 65535 and differ from the IRC port." << std::endl;
+                return 1;
+            }
+        } else if (option == "--oper-password" && i + 1 < argc) {
+            oper_password = argv[++i];
+        } else if (option == "--log-level" && i + 1 < argc) {
+            if (!Logger::setLevel(argv[++i])) {
+                std::cout << "Error: Log level must be debug, info, warn or error." << std::endl;
+                return 1;
+            }
+        } else if (option == "--io" && i + 1 < argc) {
+            backend = argv[++i];
+            if (backend != "epoll" && backend != "select" && backend != "uring") {
+                std::cout << "Error: I/O backend must be epoll, select or uring." << std::endl;
+                return 1;
+            }
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGUSR1, reportHandler);
 
+    Logger::start();
     try {
-        Server server(port, argv[2]);
+        Server server(port, argv[2], threads, backend);
+        server.setAcceptBatch(accept_batch);
+        server.setTimeouts(timeouts[0], timeouts[1], timeouts[2]);
+        server.setSendqLimits(static_cast<size_t>(sendq[0]) * 1024, static_cast<size_t>(sendq[1]) * 1024,
+                              static_cast<size_t>(sendq[2]) * 1024 * 1024);
+        server.setFloodLimits(flood[0], flood[1]);
+        server.setOperPassword(oper_password);
+        if (metrics_port > 0) {
+            server.setMetricsPort(metrics_port);
+        }
         g_server = &server;
 
-        std::cout << "IRC Server started on port " << port << std::endl;
-        std::cout << "Press Ctrl+C to stop the server" << std::endl;
+        Log(Logger::INFO, "server started").field("port", port);
 
         while (!g_shutdown_requested) {
             server.run(g_shutdown_requested);
@@ -62,9 +155,11 @@ int main(int argc, char* argv[]) {
             }
         }
     } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        Log(Logger::ERROR, "server failed").field("error", e.what());
+        Logger::stop();
         return 1;
     }
 
+    Logger::stop();
     return 0;
 }